@@ -0,0 +1,456 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <functional>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <elfio/elfio.hpp>
+
+#define DAWN_RISCV64
+#define DAWN_INSTRUCTION_CACHE
+#define DAWN_AOT
+#include "dawn/dawn.hpp"
+
+// translates the executable segments of a rv64 elf into a module that
+// machine_t::load_aot can load, every instruction the translation does not
+// cover is left to the interpreter
+
+struct region_t {
+  uint64_t              start;
+  std::vector<uint32_t> code;
+};
+
+// splits the executable segments into regions, a region ends after the first
+// instruction that ends a block or at the end of its segment, the segments
+// are added to key
+std::vector<region_t> find_regions(ELFIO::elfio &reader, dawn::aot_key_t &key) {
+  std::vector<region_t> regions;
+  for (uint32_t i = 0; i < reader.segments.size(); i++) {
+    const ELFIO::segment *segment = reader.segments[i];
+    if (segment->get_type() != ELFIO::PT_LOAD) continue;
+    if (!(segment->get_flags() & ELFIO::PF_X)) continue;
+
+    uint64_t    address = segment->get_virtual_address();
+    uint64_t    size    = segment->get_file_size() & ~uint64_t(3);
+    const char *data    = segment->get_data();
+    key.add(address, data, segment->get_file_size());
+    if (address % 4 != 0) continue;
+
+    region_t region{address, {}};
+    for (uint64_t offset = 0; offset < size; offset += 4) {
+      uint32_t instruction;
+      std::memcpy(&instruction, data + offset, sizeof(instruction));
+      region.code.push_back(instruction);
+      if (dawn::ends_block(instruction)) {
+        regions.push_back(region);
+        region = region_t{address + offset + 4, {}};
+      }
+    }
+    if (!region.code.empty()) regions.push_back(region);
+  }
+  return regions;
+}
+
+std::string hex(uint64_t value) {
+  std::stringstream ss;
+  ss << "0x" << std::hex << value << "ull";
+  return ss.str();
+}
+
+std::string imm(int64_t value) {
+  return "s(" + std::to_string(value) + "ll)";
+}
+
+// writes the body of a single instruction at pc, returns false if it is left
+// to the interpreter
+bool translate_instruction(std::ostream &o, uint32_t instruction, uint64_t pc) {
+  static void *const          no_labels[dawn::e_fused_end] = {};
+  dawn::decoded_instruction_t inst =
+      dawn::decode_instruction(instruction, no_labels);
+  std::string rd     = "x[" + std::to_string(inst.rd) + "]";
+  std::string rs1    = "x[" + std::to_string(inst.rs1) + "]";
+  std::string rs2    = "x[" + std::to_string(inst.rs2) + "]";
+  std::string i      = imm(inst.imm);
+  std::string next   = hex(pc + 4);
+  uint32_t    funct3 = dawn::extract_bit_range(instruction, 12, 15);
+
+  auto alu = [&](const std::string &value) {
+    o << "      " << rd << " = " << value << ";\n";
+    return true;
+  };
+  auto alu_w = [&](const std::string &value) {
+    return alu("s(int32_t(" + value + "))");
+  };
+  auto branch = [&](const std::string &condition) {
+    uint64_t target = pc + inst.imm;
+    if (target % 4 != 0) {
+      o << "      if (" << condition << ") stop(" << hex(pc) << ");\n";
+      o << "      *pc = " << next << ";\n";
+    } else {
+      o << "      *pc = (" << condition << ") ? " << hex(target) << " : "
+        << next << ";\n";
+    }
+    o << "      return executed + 1;\n";
+    return true;
+  };
+  auto load = [&]() {
+    o << "      load(" << funct3 << ", " << rd << ", " << rs1 << " + " << i
+      << ", " << hex(pc) << ");\n";
+    return true;
+  };
+  auto store = [&]() {
+    o << "      store(" << funct3 << ", " << rs1 << " + " << i << ", " << rs2
+      << ", " << hex(pc) << ");\n";
+    return true;
+  };
+
+  switch (dawn::decode_id(instruction)) {
+    case dawn::e_lui:
+      return alu(i);
+    case dawn::e_auipc:
+      return alu(hex(pc + inst.imm));
+    case dawn::e_jal: {
+      uint64_t target = pc + inst.imm;
+      if (target % 4 != 0) return false;
+      o << "      " << rd << " = " << next << ";\n";
+      o << "      *pc = " << hex(target) << ";\n";
+      o << "      return executed + 1;\n";
+      return true;
+    }
+    case dawn::e_jalr:
+      o << "      {\n";
+      o << "        u target = (" << rs1 << " + " << i << ") & ~u(1);\n";
+      o << "        if (target % 4 != 0) stop(" << hex(pc) << ");\n";
+      o << "        " << rd << " = " << next << ";\n";
+      o << "        *pc = target;\n";
+      o << "      }\n";
+      o << "      return executed + 1;\n";
+      return true;
+    case dawn::e_beq:
+      return branch(rs1 + " == " + rs2);
+    case dawn::e_bne:
+      return branch(rs1 + " != " + rs2);
+    case dawn::e_blt:
+      return branch("s(" + rs1 + ") < s(" + rs2 + ")");
+    case dawn::e_bge:
+      return branch("s(" + rs1 + ") >= s(" + rs2 + ")");
+    case dawn::e_bltu:
+      return branch(rs1 + " < " + rs2);
+    case dawn::e_bgeu:
+      return branch(rs1 + " >= " + rs2);
+    case dawn::e_lb:
+    case dawn::e_lh:
+    case dawn::e_lw:
+    case dawn::e_lbu:
+    case dawn::e_lhu:
+    case dawn::e_lwu:
+    case dawn::e_ld:
+      return load();
+    case dawn::e_sb:
+    case dawn::e_sh:
+    case dawn::e_sw:
+    case dawn::e_sd:
+      return store();
+    case dawn::e_addi:
+      return alu(rs1 + " + " + i);
+    case dawn::e_slti:
+      return alu("s(" + rs1 + ") < " + i);
+    case dawn::e_sltiu:
+      return alu(rs1 + " < u(" + i + ")");
+    case dawn::e_xori:
+      return alu(rs1 + " ^ " + i);
+    case dawn::e_ori:
+      return alu(rs1 + " | " + i);
+    case dawn::e_andi:
+      return alu(rs1 + " & " + i);
+    case dawn::e_slli:
+      return alu(rs1 + " << " + std::to_string(inst.imm & 63));
+    case dawn::e_srli:
+      return alu(rs1 + " >> " + std::to_string(inst.imm & 63));
+    case dawn::e_srai:
+      return alu("s(" + rs1 + ") >> " + std::to_string(inst.imm & 63));
+    case dawn::e_addiw:
+      return alu_w(rs1 + " + " + i);
+    case dawn::e_slliw:
+      return alu_w("uint32_t(" + rs1 + ") << " +
+                   std::to_string(inst.imm & 31));
+    case dawn::e_srliw:
+      return alu_w("uint32_t(" + rs1 + ") >> " +
+                   std::to_string(inst.imm & 31));
+    case dawn::e_sraiw:
+      return alu_w("int32_t(" + rs1 + ") >> " + std::to_string(inst.imm & 31));
+    case dawn::e_add:
+      return alu(rs1 + " + " + rs2);
+    case dawn::e_sub:
+      return alu(rs1 + " - " + rs2);
+    case dawn::e_sll:
+      return alu(rs1 + " << (" + rs2 + " & 63)");
+    case dawn::e_slt:
+      return alu("s(" + rs1 + ") < s(" + rs2 + ")");
+    case dawn::e_sltu:
+      return alu(rs1 + " < " + rs2);
+    case dawn::e_xor:
+      return alu(rs1 + " ^ " + rs2);
+    case dawn::e_srl:
+      return alu(rs1 + " >> (" + rs2 + " & 63)");
+    case dawn::e_sra:
+      return alu("s(" + rs1 + ") >> (" + rs2 + " & 63)");
+    case dawn::e_or:
+      return alu(rs1 + " | " + rs2);
+    case dawn::e_and:
+      return alu(rs1 + " & " + rs2);
+    case dawn::e_mul:
+      return alu(rs1 + " * " + rs2);
+    case dawn::e_mulh:
+      return alu("mulh(" + rs1 + ", " + rs2 + ")");
+    case dawn::e_mulhsu:
+      return alu("mulhsu(" + rs1 + ", " + rs2 + ")");
+    case dawn::e_mulhu:
+      return alu("mulhu(" + rs1 + ", " + rs2 + ")");
+    case dawn::e_div:
+      return alu("sdiv(" + rs1 + ", " + rs2 + ")");
+    case dawn::e_divu:
+      return alu("udiv(" + rs1 + ", " + rs2 + ")");
+    case dawn::e_rem:
+      return alu("srem(" + rs1 + ", " + rs2 + ")");
+    case dawn::e_remu:
+      return alu("urem(" + rs1 + ", " + rs2 + ")");
+    case dawn::e_addw:
+      return alu_w(rs1 + " + " + rs2);
+    case dawn::e_subw:
+      return alu_w(rs1 + " - " + rs2);
+    case dawn::e_sllw:
+      return alu_w("uint32_t(" + rs1 + ") << (" + rs2 + " & 31)");
+    case dawn::e_srlw:
+      return alu_w("uint32_t(" + rs1 + ") >> (" + rs2 + " & 31)");
+    case dawn::e_sraw:
+      return alu_w("int32_t(" + rs1 + ") >> (" + rs2 + " & 31)");
+    case dawn::e_mulw:
+      return alu_w(rs1 + " * " + rs2);
+    case dawn::e_divw:
+      return alu("sdivw(" + rs1 + ", " + rs2 + ")");
+    case dawn::e_divuw:
+      return alu("udivw(" + rs1 + ", " + rs2 + ")");
+    case dawn::e_remw:
+      return alu("sremw(" + rs1 + ", " + rs2 + ")");
+    case dawn::e_remuw:
+      return alu("uremw(" + rs1 + ", " + rs2 + ")");
+    case dawn::e_fence:
+      return true;
+    default:
+      // system, csr, atomics and fence.i
+      return false;
+  }
+}
+
+// shared by every generated source, the macros keep the sources small enough
+// to compile in reasonable time
+const char *preamble = R"(// generated by examples/aot, do not edit
+#define DAWN_RISCV64
+#define DAWN_INSTRUCTION_CACHE
+#define DAWN_AOT
+#include "dawn/dawn.hpp"
+
+using u = dawn::register_t;
+using s = dawn::sregister_t;
+
+#define region(name)                                                       \
+  uint64_t name(u *x, u *pc, void *machine,                                \
+                const dawn::jit_helpers_t *helpers, uint64_t n)
+#define stop(at)     \
+  do {               \
+    *pc = at;        \
+    return executed; \
+  } while (false)
+// every instruction checks the budget before it runs
+#define at(index, address) \
+  case index:              \
+    if (executed == n) stop(address)
+#define load(funct3, rd, addr, address)                               \
+  do {                                                                \
+    u value;                                                          \
+    if (!helpers->load[funct3](machine, addr, &value)) stop(address); \
+    rd = value;                                                       \
+  } while (false)
+#define store(funct3, addr, value, address)                           \
+  do {                                                                \
+    if (!helpers->store[funct3](machine, addr, value)) stop(address); \
+  } while (false)
+
+namespace {
+inline u mulh(u a, u b) {
+  return u((__int128)s(a) * (__int128)s(b) >> 64);
+}
+inline u mulhsu(u a, u b) {
+  return u((__int128)s(a) * (__int128)b >> 64);
+}
+inline u mulhu(u a, u b) {
+  return u((unsigned __int128)a * (unsigned __int128)b >> 64);
+}
+inline u sdiv(u a, u b) {
+  if (b == 0) return ~u(0);
+  if (s(a) == std::numeric_limits<s>::min() && s(b) == -1) return a;
+  return u(s(a) / s(b));
+}
+inline u udiv(u a, u b) { return b == 0 ? ~u(0) : a / b; }
+inline u srem(u a, u b) {
+  if (b == 0) return a;
+  if (s(a) == std::numeric_limits<s>::min() && s(b) == -1) return 0;
+  return u(s(a) % s(b));
+}
+inline u urem(u a, u b) { return b == 0 ? a : a % b; }
+inline u sdivw(u a, u b) {
+  int32_t x = int32_t(a), y = int32_t(b);
+  if (y == 0) return ~u(0);
+  if (x == std::numeric_limits<int32_t>::min() && y == -1) return s(x);
+  return s(x / y);
+}
+inline u udivw(u a, u b) {
+  uint32_t x = uint32_t(a), y = uint32_t(b);
+  return y == 0 ? ~u(0) : s(int32_t(x / y));
+}
+inline u sremw(u a, u b) {
+  int32_t x = int32_t(a), y = int32_t(b);
+  if (y == 0) return s(x);
+  if (x == std::numeric_limits<int32_t>::min() && y == -1) return 0;
+  return s(x % y);
+}
+inline u uremw(u a, u b) {
+  uint32_t x = uint32_t(a), y = uint32_t(b);
+  return y == 0 ? s(int32_t(x)) : s(int32_t(x % y));
+}
+}  // namespace
+)";
+
+// regions per generated source, sources compile in parallel
+const size_t regions_per_source = 2048;
+
+void translate_regions(std::ostream &o, const std::vector<region_t> &regions,
+                       size_t begin, size_t end) {
+  o << "#include \"aot.hpp\"\n";
+  for (size_t r = begin; r < end; r++) {
+    const region_t &region = regions[r];
+    o << "\nextern const uint32_t code_" << r << "[] = {";
+    for (size_t i = 0; i < region.code.size(); i++)
+      o << (i % 8 ? " " : "\n    ") << region.code[i] << "u,";
+    o << "\n};\n";
+    o << "region(region_" << r << ") {\n";
+    o << "  uint64_t executed = 0;\n";
+    o << "  switch ((*pc - " << hex(region.start) << ") / 4) {\n";
+    for (size_t i = 0; i < region.code.size(); i++) {
+      uint64_t pc = region.start + i * 4;
+      o << "    at(" << i << ", " << hex(pc) << ");\n";
+      std::stringstream body;
+      if (translate_instruction(body, region.code[i], pc)) {
+        o << body.str();
+        o << "      executed++;\n";
+      } else {
+        o << "      stop(" << hex(pc) << ");\n";
+      }
+    }
+    o << "  }\n";
+    o << "  stop(" << hex(region.start + region.code.size() * 4) << ");\n";
+    o << "}\n";
+  }
+}
+
+void translate_module(std::ostream &o, const std::vector<region_t> &regions,
+                      dawn::aot_key_t key) {
+  o << "#include \"aot.hpp\"\n\n";
+  for (size_t r = 0; r < regions.size(); r++)
+    o << "extern const uint32_t code_" << r << "[];\nregion(region_" << r
+      << ");\n";
+  o << "\nstatic const dawn::aot_region_t regions[] = {\n";
+  for (size_t r = 0; r < regions.size(); r++)
+    o << "    {" << hex(regions[r].start) << ", "
+      << hex(regions[r].start + regions[r].code.size() * 4) << ", code_" << r
+      << ", region_" << r << "},\n";
+  o << "};\n\n";
+  o << "extern \"C\" const dawn::aot_module_t dawn_aot_module = {\n";
+  o << "    dawn::aot_module_version, 64, " << hex(key.value) << ", "
+    << regions.size() << ", regions};\n";
+}
+
+bool write_file(const std::filesystem::path &path,
+                const std::function<void(std::ostream &)> &write) {
+  std::ofstream file{path};
+  write(file);
+  if (!file) std::cerr << "failed to write " << path << '\n';
+  return static_cast<bool>(file);
+}
+
+int main(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: [aot] [elf] [module.so | cache directory]\n";
+    return -1;
+  }
+  ELFIO::elfio reader;
+  if (!reader.load(argv[1])) {
+    std::cerr << "failed to load " << argv[1] << '\n';
+    return -1;
+  }
+  if (reader.get_class() != ELFIO::ELFCLASS64 ||
+      reader.get_machine() != ELFIO::EM_RISCV) {
+    std::cerr << argv[1] << " is not a rv64 elf\n";
+    return -1;
+  }
+  dawn::aot_key_t       key;
+  std::vector<region_t> regions = find_regions(reader, key);
+
+  // a cache directory holds a module per key, see machine_t::load_aot_cache
+  std::filesystem::path output = argv[2];
+  if (std::filesystem::is_directory(output)) {
+    output /= key.file_name();
+    if (std::filesystem::exists(output)) {
+      std::cout << output.string() << " is up to date\n";
+      return 0;
+    }
+  }
+
+  // the generated sources are kept next to the module
+  std::filesystem::path sources = output;
+  sources += ".src";
+  std::filesystem::create_directories(sources);
+  std::vector<std::filesystem::path> files{sources / "module.cpp"};
+  if (!write_file(sources / "aot.hpp",
+                  [](std::ostream &o) { o << preamble; }) ||
+      !write_file(files[0], [&](std::ostream &o) {
+        translate_module(o, regions, key);
+      }))
+    return -1;
+  for (size_t begin = 0; begin < regions.size();
+       begin += regions_per_source) {
+    size_t end = std::min(begin + regions_per_source, regions.size());
+    files.push_back(sources /
+                    ("regions_" + std::to_string(files.size()) + ".cpp"));
+    if (!write_file(files.back(), [&](std::ostream &o) {
+          translate_regions(o, regions, begin, end);
+        }))
+      return -1;
+  }
+
+  // Note: CXX picks the compiler, the module only needs dawn's headers
+  const char       *cxx = std::getenv("CXX");
+  std::stringstream command;
+  command << "printf '%s\\n'";
+  for (const auto &file : files) command << " '" << file.string() << "'";
+  command << " | xargs -P " << std::max(1u, std::thread::hardware_concurrency())
+          << " -I{} " << (cxx ? cxx : "c++")
+          << " -std=c++23 -O1 -fPIC -w -I'" << DAWN_INCLUDE_DIR
+          << "' -c {} -o {}.o && " << (cxx ? cxx : "c++") << " -shared";
+  for (const auto &file : files) command << " '" << file.string() << ".o'";
+  // Note: linked next to the module and renamed, so a process loading from
+  // the same cache never sees a partial module
+  std::filesystem::path linked = output;
+  linked += ".tmp";
+  command << " -o '" << linked.string() << "'";
+  if (std::system(command.str().c_str()) != 0) return -1;
+  std::filesystem::rename(linked, output);
+  return 0;
+}
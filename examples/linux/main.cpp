@@ -19,6 +19,7 @@
 
 #define DAWN_RISCV64
 #define DAWN_INSTRUCTION_CACHE
+#define DAWN_FLAT_RAM
 #include "dawn/dawn.hpp"
 
 std::string to_hex_string(uint64_t val) { return std::format("{:#x}", val); }
@@ -603,6 +604,11 @@ int main(int argc, char **argv) {
       ram_size,
       {uart_handler, plic_handler, clint_handler, framebuffer_handler}, nullptr,
       allocate, deallocate, dawn::page_metadata_t::e_rwx);
+  // ram is backed by 2 MB host pages where the host has them
+  // Note: the kernel, dtb and initrd are copied into the window, so it has to
+  // be there before them
+  if (!machine->map_ram(offset, ram_size, true))
+    throw std::runtime_error("failed to map ram");
 
   // read kernel
   auto kernel = read_file(argv[1]);
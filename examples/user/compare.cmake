@@ -0,0 +1,31 @@
+# runs ELF with BASELINE and with ENGINE, both have to exit with 0 and print
+# the same thing, given AOT the module it writes to MODULE is passed to ENGINE
+execute_process(COMMAND ${BASELINE} ${ELF}
+  OUTPUT_VARIABLE expected
+  RESULT_VARIABLE expected_result
+)
+if (NOT expected_result EQUAL 0)
+  message(FATAL_ERROR "${BASELINE} ${ELF} failed: ${expected_result}")
+endif()
+
+set(arguments ${ELF})
+if (AOT)
+  file(REMOVE ${MODULE})
+  execute_process(COMMAND ${AOT} ${ELF} ${MODULE} RESULT_VARIABLE result)
+  if (NOT result EQUAL 0)
+    message(FATAL_ERROR "${AOT} ${ELF} ${MODULE} failed: ${result}")
+  endif()
+  list(APPEND arguments ${MODULE})
+endif()
+
+execute_process(COMMAND ${ENGINE} ${arguments}
+  OUTPUT_VARIABLE output
+  RESULT_VARIABLE result
+)
+if (NOT result EQUAL 0)
+  message(FATAL_ERROR "${ENGINE} ${arguments} failed: ${result}")
+endif()
+if (NOT output STREQUAL expected)
+  message(FATAL_ERROR "${ENGINE} ${arguments} printed\n${output}\n"
+                      "${BASELINE} ${ELF} printed\n${expected}")
+endif()
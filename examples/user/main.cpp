@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <bitset>
 #include <cassert>
 #include <cstdio>
@@ -15,11 +16,15 @@
 #define DAWN_RISCV64
 #include "dawn/dawn.hpp"
 
+// user mode script, every trap goes to the trap callback below
+using machine_t = dawn::machine_t<32, 12, 4, 10, 1,
+                                  dawn::machine_profile_t::e_application>;
+
 uint8_t* allocate(void*, uint64_t size) { return new uint8_t[size]; }
 void     deallocate(void*, uint8_t* ptr) { delete[] ptr; }
 
 struct data_t {
-  dawn::machine_t<32, 12> machine;
+  machine_t               machine;
   uint64_t                heap_start;
   uint64_t                heap_end;
   uint64_t                stack_top;
@@ -27,6 +32,9 @@ struct data_t {
   uint64_t                custom_shared_memory_start;
   uint64_t                custom_shared_memory_end;
   std::unordered_map<uint64_t, std::function<void(data_t*)>> syscall_callbacks;
+#ifdef DAWN_AOT
+  dawn::aot_key_t aot_key = {};  // of the executable segments
+#endif
 };
 
 data_t* load_elf(const std::filesystem::path& path) {
@@ -48,12 +56,25 @@ data_t* load_elf(const std::filesystem::path& path) {
   }
 
   data_t* data = new data_t{
-      .machine = dawn::machine_t<32, 12>{16 * 1024 * 1024,
-                                         {},
-                                         nullptr,
-                                         allocate,
-                                         deallocate,
-                                         dawn::page_metadata_t::e_none}};
+      .machine = machine_t{16 * 1024 * 1024,
+                           {},
+                           nullptr,
+                           allocate,
+                           deallocate,
+                           dawn::page_metadata_t::e_none}};
+
+  // TODO: remove magic number
+  data->custom_shared_memory_start = data->custom_shared_memory_end =
+      0x60000000;
+#ifdef DAWN_SANDBOX
+  // the elf and the heap run in the sandbox, the shared memory and the stack
+  // above it keep using pages
+  uint64_t sandbox_base =
+      guest_base & ~(data->machine._memory.bytes_per_page - 1);
+  if (!data->machine.map_ram(sandbox_base, data->custom_shared_memory_start -
+                                               sandbox_base))
+    return nullptr;
+#endif
 
   for (uint32_t i = 0; i < reader.segments.size(); i++) {
     const ELFIO::segment* segment = reader.segments[i];
@@ -71,6 +92,10 @@ data_t* load_elf(const std::filesystem::path& path) {
     if (is_write) permission |= dawn::page_metadata_t::e_w;
     if (is_exec) permission |= dawn::page_metadata_t::e_x;
 
+#ifdef DAWN_AOT
+    if (is_exec)
+      data->aot_key.add(virtual_address, segment->get_data(), file_size);
+#endif
     if (!data->machine.insert_memory(
             virtual_address, reinterpret_cast<const void*>(segment->get_data()),
             file_size, permission))
@@ -126,10 +151,6 @@ data_t* load_elf(const std::filesystem::path& path) {
   data->stack_bottom = data->stack_top - (8 * 1024);
   data->heap_end     = data->heap_start;
 
-  // TODO: remove magic number
-  data->custom_shared_memory_start = data->custom_shared_memory_end =
-      0x60000000;
-
   return data;
 }
 
@@ -141,6 +162,17 @@ int main(int argc, char** argv) {
 
   data_t* data = load_elf(argv[1]);
   if (!data) return -1;  // TODO: throw
+#ifdef DAWN_AOT
+  // module written by examples/aot for the same elf, or the cache directory
+  // it was written to, the script runs interpreted until the module is there
+  if (argc > 2 && std::filesystem::is_directory(argv[2])) {
+    if (!data->machine.load_aot_cache(argv[2], data->aot_key))
+      std::cerr << "no module for " << argv[1] << " in " << argv[2] << '\n';
+  } else if (argc > 2 && !data->machine.load_aot(argv[2])) {
+    std::cerr << "failed to load " << argv[2] << '\n';
+    return -1;
+  }
+#endif
 
   bool running = true;
 
@@ -177,8 +209,8 @@ int main(int argc, char** argv) {
 
   // exit
   data->syscall_callbacks[93] = [&running](data_t* data) {
-    running            = false;
-    data->machine._wfi = true;
+    running = false;
+    data->machine.request_exit();
     // exit(data->machine._reg[10]);
   };
 
@@ -198,6 +230,8 @@ int main(int argc, char** argv) {
   static const uint64_t shared_memory_size =
       data->machine._memory.bytes_per_page;
   uint8_t* shared_memory = allocate(nullptr, shared_memory_size);
+  // zeroed, the dumps below should not depend on what the host heap held
+  std::fill_n(shared_memory, shared_memory_size, 0);
   data->custom_shared_memory_end =
       data->custom_shared_memory_start + shared_memory_size;
   assert(data->custom_shared_memory_end <= data->stack_bottom);
@@ -269,7 +303,7 @@ int main(int argc, char** argv) {
 
   while (running) {
     // std::cout << "pc: " << std::hex << data->machine._pc << '\n';
-    data->machine.step(1);
+    data->machine.run(std::numeric_limits<uint64_t>::max());
     // for (uint32_t i = 0; i < 32; i++) {
     //   if (data->machine._reg[i] != 0)
     //     std::cout << "\tx" << std::dec << i << ": " << std::hex
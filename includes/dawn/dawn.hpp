@@ -4,22 +4,42 @@
 #include <atomic>
 #include <bitset>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
 #include <functional>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <limits>
 #include <list>
 #include <map>
+#include <mutex>
 #include <optional>
 #include <ostream>
 #include <sstream>
 #include <stdexcept>
+#include <thread>
+#include <type_traits>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#if defined(DAWN_JIT) || defined(DAWN_FLAT_RAM)
+#include <sys/mman.h>
+#endif
+#ifdef DAWN_SANDBOX
+#include <csignal>
+#include <unistd.h>
+#endif
+#ifdef DAWN_AOT
+#include <dlfcn.h>
+
+#include <filesystem>
+#endif
+
 namespace dawn {
 
 #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
@@ -349,6 +369,437 @@ struct instruction_t {
 };
 static_assert(sizeof(instruction_t) == 4, "instruction size should be 4 bytes");
 
+// register file slot after x31, writes to x0 are redirected here at decode so
+// x0 never has to be reset between instructions
+constexpr uint32_t sink_register = 32;
+
+// instruction with its handler, operands and sign extended immediate already
+// resolved, handlers only read these fields
+struct decoded_instruction_t {
+  void       *label;
+  uint32_t    instruction;
+  uint8_t     rd;
+  uint8_t     rs1;
+  uint8_t     rs2;
+  sregister_t imm;
+};
+
+// every instruction the interpreter knows, the dispatch tables are indexed by
+// these ids so every entry lands on a leaf handler
+enum instruction_id_t : uint8_t {
+  e_unknown_instruction,
+  e_lui,
+  e_auipc,
+  e_jal,
+  e_jalr,
+  e_beq,
+  e_bne,
+  e_blt,
+  e_bge,
+  e_bltu,
+  e_bgeu,
+  e_lb,
+  e_lh,
+  e_lw,
+  e_lbu,
+  e_lhu,
+  e_lwu,
+  e_ld,
+  e_sb,
+  e_sh,
+  e_sw,
+  e_sd,
+  e_addi,
+  e_slti,
+  e_sltiu,
+  e_xori,
+  e_ori,
+  e_andi,
+  e_slli,
+  e_srli,
+  e_srai,
+  e_addiw,
+  e_slliw,
+  e_srliw,
+  e_sraiw,
+  e_add,
+  e_sub,
+  e_sll,
+  e_slt,
+  e_sltu,
+  e_xor,
+  e_srl,
+  e_sra,
+  e_or,
+  e_and,
+  e_mul,
+  e_mulh,
+  e_mulhsu,
+  e_mulhu,
+  e_div,
+  e_divu,
+  e_rem,
+  e_remu,
+  e_addw,
+  e_subw,
+  e_sllw,
+  e_srlw,
+  e_sraw,
+  e_mulw,
+  e_divw,
+  e_divuw,
+  e_remw,
+  e_remuw,
+  e_fence,
+  e_fence_i,
+  e_ecall,
+  e_ebreak,
+  e_mret,
+  e_wfi,
+  e_csrrw,
+  e_csrrs,
+  e_csrrc,
+  e_csrrwi,
+  e_csrrsi,
+  e_csrrci,
+  e_lr_w,
+  e_sc_w,
+  e_amoswap_w,
+  e_amoadd_w,
+  e_amoxor_w,
+  e_amoand_w,
+  e_amoor_w,
+  e_amomin_w,
+  e_amomax_w,
+  e_amominu_w,
+  e_amomaxu_w,
+  e_lr_d,
+  e_sc_d,
+  e_amoswap_d,
+  e_amoadd_d,
+  e_amoxor_d,
+  e_amoand_d,
+  e_amoor_d,
+  e_amomin_d,
+  e_amomax_d,
+  e_amominu_d,
+  e_amomaxu_d,
+  e_instruction_end,
+};
+
+// bits [start, end) that tell apart instructions sharing opcode and funct3
+struct decode_field_t {
+  uint8_t start;
+  uint8_t end;
+};
+constexpr decode_field_t no_field      = {0, 0};
+constexpr decode_field_t funct7_field  = {25, 32};
+constexpr decode_field_t funct6_field  = {26, 32};  // shamt[5] is part of imm
+constexpr decode_field_t funct5_field  = {27, 32};  // aq and rl are ignored
+constexpr decode_field_t funct12_field = {20, 32};
+
+// funct3 value matching every funct3
+constexpr uint32_t any_funct3 = 8;
+
+// op is opcode[6:2], field holds value for the instruction
+struct instruction_description_t {
+  instruction_id_t id;
+  uint32_t         op;
+  uint32_t         funct3;
+  decode_field_t   field;
+  uint32_t         value;
+};
+
+// Note: the decoder below is generated from this table at compile time, an
+// instruction is added by adding its row and a handler for its id
+constexpr instruction_description_t instruction_descriptions[] = {
+    {e_lui, 0b01101, any_funct3, no_field, 0},
+    {e_auipc, 0b00101, any_funct3, no_field, 0},
+    {e_jal, 0b11011, any_funct3, no_field, 0},
+    {e_jalr, 0b11001, any_funct3, no_field, 0},
+    {e_beq, 0b11000, 0b000, no_field, 0},
+    {e_bne, 0b11000, 0b001, no_field, 0},
+    {e_blt, 0b11000, 0b100, no_field, 0},
+    {e_bge, 0b11000, 0b101, no_field, 0},
+    {e_bltu, 0b11000, 0b110, no_field, 0},
+    {e_bgeu, 0b11000, 0b111, no_field, 0},
+    {e_lb, 0b00000, 0b000, no_field, 0},
+    {e_lh, 0b00000, 0b001, no_field, 0},
+    {e_lw, 0b00000, 0b010, no_field, 0},
+    {e_lbu, 0b00000, 0b100, no_field, 0},
+    {e_lhu, 0b00000, 0b101, no_field, 0},
+    {e_sb, 0b01000, 0b000, no_field, 0},
+    {e_sh, 0b01000, 0b001, no_field, 0},
+    {e_sw, 0b01000, 0b010, no_field, 0},
+    {e_addi, 0b00100, 0b000, no_field, 0},
+    {e_slti, 0b00100, 0b010, no_field, 0},
+    {e_sltiu, 0b00100, 0b011, no_field, 0},
+    {e_xori, 0b00100, 0b100, no_field, 0},
+    {e_ori, 0b00100, 0b110, no_field, 0},
+    {e_andi, 0b00100, 0b111, no_field, 0},
+    {e_slli, 0b00100, 0b001, no_field, 0},
+    {e_srli, 0b00100, 0b101, funct6_field, 0b000000},
+    {e_srai, 0b00100, 0b101, funct6_field, 0b010000},
+    {e_add, 0b01100, 0b000, funct7_field, 0b0000000},
+    {e_sub, 0b01100, 0b000, funct7_field, 0b0100000},
+    {e_sll, 0b01100, 0b001, funct7_field, 0b0000000},
+    {e_slt, 0b01100, 0b010, funct7_field, 0b0000000},
+    {e_sltu, 0b01100, 0b011, funct7_field, 0b0000000},
+    {e_xor, 0b01100, 0b100, funct7_field, 0b0000000},
+    {e_srl, 0b01100, 0b101, funct7_field, 0b0000000},
+    {e_sra, 0b01100, 0b101, funct7_field, 0b0100000},
+    {e_or, 0b01100, 0b110, funct7_field, 0b0000000},
+    {e_and, 0b01100, 0b111, funct7_field, 0b0000000},
+    {e_mul, 0b01100, 0b000, funct7_field, 0b0000001},
+    {e_mulh, 0b01100, 0b001, funct7_field, 0b0000001},
+    {e_mulhsu, 0b01100, 0b010, funct7_field, 0b0000001},
+    {e_mulhu, 0b01100, 0b011, funct7_field, 0b0000001},
+    {e_div, 0b01100, 0b100, funct7_field, 0b0000001},
+    {e_divu, 0b01100, 0b101, funct7_field, 0b0000001},
+    {e_rem, 0b01100, 0b110, funct7_field, 0b0000001},
+    {e_remu, 0b01100, 0b111, funct7_field, 0b0000001},
+    {e_fence, 0b00011, 0b000, no_field, 0},
+    {e_fence_i, 0b00011, 0b001, no_field, 0},
+    {e_ecall, 0b11100, 0b000, funct12_field, 0b000000000000},
+    {e_ebreak, 0b11100, 0b000, funct12_field, 0b000000000001},
+    {e_mret, 0b11100, 0b000, funct12_field, 0b001100000010},
+    {e_wfi, 0b11100, 0b000, funct12_field, 0b000100000101},
+    {e_csrrw, 0b11100, 0b001, no_field, 0},
+    {e_csrrs, 0b11100, 0b010, no_field, 0},
+    {e_csrrc, 0b11100, 0b011, no_field, 0},
+    {e_csrrwi, 0b11100, 0b101, no_field, 0},
+    {e_csrrsi, 0b11100, 0b110, no_field, 0},
+    {e_csrrci, 0b11100, 0b111, no_field, 0},
+    {e_lr_w, 0b01011, 0b010, funct5_field, 0b00010},
+    {e_sc_w, 0b01011, 0b010, funct5_field, 0b00011},
+    {e_amoswap_w, 0b01011, 0b010, funct5_field, 0b00001},
+    {e_amoadd_w, 0b01011, 0b010, funct5_field, 0b00000},
+    {e_amoxor_w, 0b01011, 0b010, funct5_field, 0b00100},
+    {e_amoand_w, 0b01011, 0b010, funct5_field, 0b01100},
+    {e_amoor_w, 0b01011, 0b010, funct5_field, 0b01000},
+    {e_amomin_w, 0b01011, 0b010, funct5_field, 0b10000},
+    {e_amomax_w, 0b01011, 0b010, funct5_field, 0b10100},
+    {e_amominu_w, 0b01011, 0b010, funct5_field, 0b11000},
+    {e_amomaxu_w, 0b01011, 0b010, funct5_field, 0b11100},
+#ifdef DAWN_RISCV64
+    {e_lwu, 0b00000, 0b110, no_field, 0},
+    {e_ld, 0b00000, 0b011, no_field, 0},
+    {e_sd, 0b01000, 0b011, no_field, 0},
+    {e_addiw, 0b00110, 0b000, no_field, 0},
+    {e_slliw, 0b00110, 0b001, no_field, 0},
+    {e_srliw, 0b00110, 0b101, funct7_field, 0b0000000},
+    {e_sraiw, 0b00110, 0b101, funct7_field, 0b0100000},
+    {e_addw, 0b01110, 0b000, funct7_field, 0b0000000},
+    {e_subw, 0b01110, 0b000, funct7_field, 0b0100000},
+    {e_mulw, 0b01110, 0b000, funct7_field, 0b0000001},
+    {e_sllw, 0b01110, 0b001, no_field, 0},
+    {e_divw, 0b01110, 0b100, no_field, 0},
+    {e_srlw, 0b01110, 0b101, funct7_field, 0b0000000},
+    {e_sraw, 0b01110, 0b101, funct7_field, 0b0100000},
+    {e_divuw, 0b01110, 0b101, funct7_field, 0b0000001},
+    {e_remw, 0b01110, 0b110, no_field, 0},
+    {e_remuw, 0b01110, 0b111, no_field, 0},
+    {e_lr_d, 0b01011, 0b011, funct5_field, 0b00010},
+    {e_sc_d, 0b01011, 0b011, funct5_field, 0b00011},
+    {e_amoswap_d, 0b01011, 0b011, funct5_field, 0b00001},
+    {e_amoadd_d, 0b01011, 0b011, funct5_field, 0b00000},
+    {e_amoxor_d, 0b01011, 0b011, funct5_field, 0b00100},
+    {e_amoand_d, 0b01011, 0b011, funct5_field, 0b01100},
+    {e_amoor_d, 0b01011, 0b011, funct5_field, 0b01000},
+    {e_amomin_d, 0b01011, 0b011, funct5_field, 0b10000},
+    {e_amomax_d, 0b01011, 0b011, funct5_field, 0b10100},
+    {e_amominu_d, 0b01011, 0b011, funct5_field, 0b11000},
+    {e_amomaxu_d, 0b01011, 0b011, funct5_field, 0b11100},
+#endif
+};
+
+// f f f o o o o o (f is func3, o is op)
+// Note: we ignore the first 2 bits of op since we dont implement compressed
+// instructions
+constexpr inline uint32_t dispatch_index(uint32_t instruction) {
+  return extract_bit_range(instruction, 2, 7) |
+         extract_bit_range(instruction, 12, 15) << 5;
+}
+
+constexpr inline bool in_slot(const instruction_description_t &description,
+                              uint32_t                         slot) {
+  return description.op == (slot & 0b11111) &&
+         (description.funct3 == any_funct3 || description.funct3 == slot >> 5);
+}
+
+// dispatch_index picks a slot, the field of the slot picks the leaf
+struct decoder_slot_t {
+  uint8_t  shift;
+  uint32_t mask;  // 0 for slots holding a single instruction
+  uint32_t base;
+};
+
+constexpr inline uint32_t decoder_leaf_count() {
+  uint32_t count = 1;  // leaf 0 is the unknown instruction of empty slots
+  for (uint32_t slot = 0; slot < 256; slot++) {
+    for (const auto &description : instruction_descriptions) {
+      if (!in_slot(description, slot)) continue;
+      count += 1u << (description.field.end - description.field.start);
+      break;
+    }
+  }
+  return count;
+}
+
+struct decoder_t {
+  decoder_slot_t   slots[256];
+  instruction_id_t leaves[decoder_leaf_count()];
+};
+
+constexpr inline decoder_t make_decoder() {
+  decoder_t decoder{};
+  uint32_t  next = 1;
+  for (uint32_t slot = 0; slot < 256; slot++) {
+    decoder_slot_t &entry = decoder.slots[slot];
+    bool            empty = true;
+    for (const auto &description : instruction_descriptions) {
+      if (!in_slot(description, slot)) continue;
+      const decode_field_t &field = description.field;
+      const uint32_t        mask  = (1u << (field.end - field.start)) - 1;
+      if (empty) {
+        empty       = false;
+        entry.shift = field.start;
+        entry.mask  = mask;
+        entry.base  = next;
+        next += mask + 1;
+      } else if (entry.shift != field.start || entry.mask != mask) {
+        throw std::logic_error("instructions of a slot use different fields");
+      }
+      instruction_id_t &leaf = decoder.leaves[entry.base + description.value];
+      if (leaf != e_unknown_instruction)
+        throw std::logic_error("two instructions share an encoding");
+      leaf = description.id;
+    }
+  }
+  return decoder;
+}
+
+constexpr decoder_t instruction_decoder = make_decoder();
+
+// one table lookup, no further switch on funct7, funct5 or imm
+constexpr inline instruction_id_t decode_id(uint32_t instruction) {
+  const decoder_slot_t &slot =
+      instruction_decoder.slots[dispatch_index(instruction)];
+  return instruction_decoder
+      .leaves[slot.base + ((instruction >> slot.shift) & slot.mask)];
+}
+
+static_assert(decode_id(0x00a00513) == e_addi, "li a0, 10");
+static_assert(decode_id(0x40b50533) == e_sub, "sub a0, a0, a1");
+static_assert(decode_id(0x02b50533) == e_mul, "mul a0, a0, a1");
+static_assert(decode_id(0x00000073) == e_ecall, "ecall");
+static_assert(decode_id(0xffffffff) == e_unknown_instruction, "not rv64ima");
+
+inline decoded_instruction_t decode_instruction(uint32_t    instruction,
+                                                void *const *dispatch_table) {
+  instruction_t inst;
+  reinterpret_cast<uint32_t &>(inst) = instruction;
+
+  decoded_instruction_t decoded{};
+  decoded.label       = dispatch_table[decode_id(instruction)];
+  decoded.instruction = instruction;
+  decoded.rd          = inst.as.r_type.rd();
+  if (decoded.rd == 0) decoded.rd = sink_register;
+  decoded.rs1         = inst.as.r_type.rs1();
+  decoded.rs2         = inst.as.r_type.rs2();
+  switch (extract_bit_range(instruction, 2, 7)) {
+    case 0b01101:  // lui
+    case 0b00101:  // auipc
+      decoded.imm = static_cast<int32_t>(inst.as.u_type.imm() << 12);
+      break;
+    case 0b11011:  // jal
+      decoded.imm = inst.as.j_type.imm_sext();
+      break;
+    case 0b11000:  // branch
+      decoded.imm = inst.as.b_type.imm_sext();
+      break;
+    case 0b01000:  // store
+      decoded.imm = inst.as.s_type.imm_sext();
+      break;
+    case 0b11100:  // system, csr address is not sign extended
+      decoded.imm = inst.as.i_type.imm();
+      break;
+    default:
+      decoded.imm = inst.as.i_type.imm_sext();
+      break;
+  }
+  return decoded;
+}
+
+// true for instructions after which a block must end, either because they
+// change pc or because they may change state the translation depends on
+constexpr inline bool ends_block(uint32_t instruction) {
+  switch (extract_bit_range(instruction, 2, 7)) {
+    case 0b11011:  // jal
+    case 0b11001:  // jalr
+    case 0b11000:  // branch
+    case 0b11100:  // system, csr
+      return true;
+    case 0b00011:  // fence.i, a plain fence does not change any state
+      return extract_bit_range(instruction, 12, 15) == 0b001;
+    default:
+      return false;
+  }
+}
+
+// superinstructions, their handlers live in the dispatch table after the
+// regular instructions
+enum fused_instruction_t : uint32_t {
+  e_fused_lui_addi = e_instruction_end,  // li
+  e_fused_lui_addiw,       // li of a 32 bit constant
+  e_fused_auipc_addi,      // la
+  e_fused_auipc_jalr,      // call, tail
+  e_fused_auipc_load,      // register sized pc relative load
+  e_fused_slli_srli,       // zext.w
+  e_fused_slt_branch,      // slt + beqz/bnez
+  e_fused_sltu_branch,     // sltu + beqz/bnez
+  e_fused_end,
+};
+
+// dispatch table index of the superinstruction for a pair of instructions, 0
+// if they run separately
+// Note: in every pair the second instruction reads the register the first one
+// writes, so the first one can never write the sink
+constexpr inline uint32_t fused_index(const decoded_instruction_t &first,
+                                      const decoded_instruction_t &second) {
+  if (first.rd == sink_register) return 0;
+  // ld on rv64, lw on rv32
+  const instruction_id_t register_load = sizeof(register_t) == 8 ? e_ld : e_lw;
+  const instruction_id_t second_id     = decode_id(second.instruction);
+  const bool             reads_rd      = second.rs1 == first.rd;
+  const bool             overwrites_rd = reads_rd && second.rd == first.rd;
+  switch (decode_id(first.instruction)) {
+    case e_lui:
+      if (overwrites_rd && second_id == e_addi) return e_fused_lui_addi;
+      if (overwrites_rd && second_id == e_addiw) return e_fused_lui_addiw;
+      return 0;
+    case e_auipc:
+      if (overwrites_rd && second_id == e_addi) return e_fused_auipc_addi;
+      if (reads_rd && second_id == e_jalr) return e_fused_auipc_jalr;
+      if (reads_rd && second_id == register_load) return e_fused_auipc_load;
+      return 0;
+    case e_slli:  // slli 32, srli 32
+      if (sizeof(register_t) == 8 && overwrites_rd && first.imm == 32 &&
+          second.imm == 32 && second_id == e_srli)
+        return e_fused_slli_srli;
+      return 0;
+    case e_slt:  // slt, sltu and beqz, bnez
+    case e_sltu:
+      if (!reads_rd || second.rs2 != 0 ||
+          (second_id != e_beq && second_id != e_bne))
+        return 0;
+      return decode_id(first.instruction) == e_slt ? e_fused_slt_branch
+                                                   : e_fused_sltu_branch;
+    default:
+      return 0;
+  }
+}
+
 // TODO: figure out is this is required for 32 bits
 constexpr inline void mul_64x64_u(uint64_t a, uint64_t b, uint64_t result[2]) {
   const uint64_t mask_32    = 0xffffffffull;
@@ -385,9 +836,12 @@ enum page_metadata_t : register_t {
   // TODO: verify if I need to add e_m here as well, and any other meta data I
   // might add in future
   e_m    = static_cast<register_t>(1) << (sizeof(register_t) * 8 - 4),
+  // the page holds decoded code, stores to it take the slow path and drop
+  // that code, only set by the machine
+  e_c    = static_cast<register_t>(1) << (sizeof(register_t) * 8 - 5),
   e_rwm  = e_rw | e_m,
   e_rwx  = e_r | e_w | e_x,
-  e_mask = e_r | e_w | e_x | e_m,
+  e_mask = e_r | e_w | e_x | e_m | e_c,
 };
 
 inline page_metadata_t operator|(page_metadata_t l, page_metadata_t r) {
@@ -403,8 +857,8 @@ struct mmio_page_data_t {
   std::vector<mmio_handler_t> mmios{};
 };
 
-register_t mmio_page_data_load(mmio_page_data_t &mmio_page_data,
-                               register_t        addr) {
+inline register_t mmio_page_data_load(mmio_page_data_t &mmio_page_data,
+                                      register_t        addr) {
   if (mmio_page_data.mru_mmio.start <= addr &&
       addr < mmio_page_data.mru_mmio.stop) {
     return mmio_page_data.mru_mmio.load(&mmio_page_data.mru_mmio, addr);
@@ -418,8 +872,8 @@ register_t mmio_page_data_load(mmio_page_data_t &mmio_page_data,
   throw std::runtime_error("reached unreachable");
 }
 
-void mmio_page_data_store(mmio_page_data_t &mmio_page_data, register_t addr,
-                          register_t value) {
+inline void mmio_page_data_store(mmio_page_data_t &mmio_page_data,
+                                 register_t addr, register_t value) {
   if (mmio_page_data.mru_mmio.start <= addr &&
       addr < mmio_page_data.mru_mmio.stop) {
     mmio_page_data.mru_mmio.store(&mmio_page_data.mru_mmio, addr, value);
@@ -448,18 +902,152 @@ struct page_t {
   }
 };
 
-template <size_t __direct_cache_size = 32, size_t __bits_per_page = 12>
+// page number -> page, a radix tree over the bits of the page number, inner
+// nodes are arrays of child pointers and leaves are contiguous arrays of pages,
+// so a lookup is a load per level without hashing
+template <size_t __bits_per_page>
+struct page_table_t {
+  static constexpr register_t bits_per_level = 9;
+  static constexpr register_t page_number_bits =
+      sizeof(register_t) * 8 - __bits_per_page;
+  static constexpr register_t levels =
+      (page_number_bits + bits_per_level - 1) / bits_per_level;
+  static constexpr register_t entries_per_node = 1 << bits_per_level;
+
+  struct node_t {
+    void *children[entries_per_node] = {};
+  };
+  struct leaf_t {
+    page_t pages[entries_per_node];
+  };
+
+  page_table_t() = default;
+  page_table_t(const page_table_t &) = delete;
+  page_table_t &operator=(const page_table_t &) = delete;
+  ~page_table_t() { destroy(_root, 0); }
+
+  static constexpr register_t index(register_t page_number, register_t level) {
+    return (page_number >> ((levels - 1 - level) * bits_per_level)) &
+           (entries_per_node - 1);
+  }
+
+  // nullptr if the page was never inserted
+  inline page_t *find(register_t page_number) const {
+    void *node = _root;
+    for (register_t level = 0; level + 1 < levels; level++) {
+      if (!node) return nullptr;
+      node = static_cast<node_t *>(node)->children[index(page_number, level)];
+    }
+    if (!node) return nullptr;
+    page_t *page =
+        &static_cast<leaf_t *>(node)->pages[index(page_number, levels - 1)];
+    return page->ptr ? page : nullptr;
+  }
+  inline bool contains(register_t page_number) const {
+    return find(page_number);
+  }
+  // the entry of a page, the nodes on its path are allocated as needed
+  inline page_t &operator[](register_t page_number) {
+    void **node = &_root;
+    for (register_t level = 0; level + 1 < levels; level++) {
+      if (!*node) *node = new node_t{};
+      node = &static_cast<node_t *>(*node)->children[index(page_number, level)];
+    }
+    if (!*node) *node = new leaf_t{};
+    return static_cast<leaf_t *>(*node)->pages[index(page_number, levels - 1)];
+  }
+
+  static void destroy(void *node, register_t level) {
+    if (!node) return;
+    if (level + 1 == levels) {
+      delete static_cast<leaf_t *>(node);
+      return;
+    }
+    for (void *child : static_cast<node_t *>(node)->children)
+      destroy(child, level + 1);
+    delete static_cast<node_t *>(node);
+  }
+
+  void *_root = nullptr;
+};
+
+#ifdef DAWN_SANDBOX
+#if !defined(DAWN_FLAT_RAM) || !defined(__GNUC__) || defined(__clang__)
+static_assert(false, "DAWN_SANDBOX needs DAWN_FLAT_RAM and gcc");
+#endif
+#if defined(DAWN_TAIL_CALL) || defined(DAWN_JIT) || defined(DAWN_AOT)
+static_assert(false, "DAWN_SANDBOX needs the computed goto interpreter");
+#endif
+
+// a guest access the host mmu refused, thrown out of the SIGSEGV handler
+// Note: only code built with -fnon-call-exceptions can throw from a faulting
+// load or store
+struct sandbox_fault_t {
+  register_t addr;
+};
+
+// the guest view of the window of the machine running on this thread
+struct sandbox_window_t {
+  uint8_t   *begin = nullptr;
+  uint8_t   *end   = nullptr;
+  register_t base  = 0;
+};
+inline thread_local sandbox_window_t sandbox_window;
+inline struct sigaction              sandbox_previous_action;
+
+inline void sandbox_signal_handler(int, siginfo_t *info, void *) {
+  uint8_t *addr = static_cast<uint8_t *>(info->si_addr);
+  if (addr >= sandbox_window.begin && addr < sandbox_window.end)
+    throw sandbox_fault_t{sandbox_window.base +
+                          static_cast<register_t>(addr - sandbox_window.begin)};
+  // not a guest access, it faults again with the previous action
+  sigaction(SIGSEGV, &sandbox_previous_action, nullptr);
+}
+
+inline void install_sandbox_handler() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+    struct sigaction action = {};
+    action.sa_sigaction     = sandbox_signal_handler;
+    // Note: the handler never returns for guest faults, SA_NODEFER keeps
+    // SIGSEGV unblocked after it threw
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGSEGV, &action, &sandbox_previous_action);
+  });
+}
+#endif
+
+template <size_t __tlb_size = 32, size_t __bits_per_page = 12,
+          size_t __tlb_ways = 4>
 struct memory_t {
   static const register_t bits_per_page = __bits_per_page;
-  static_assert(bits_per_page <= sizeof(register_t) * 8 - 4,
+  static_assert(bits_per_page <= sizeof(register_t) * 8 - 5,
                 "bits_per_page needs enough space for metadata handling");
-  static const register_t bytes_per_page    = 1 << bits_per_page;
-  const register_t        direct_cache_size = __direct_cache_size;
+  // Note: the offset bits of a tag have to fit an 8 byte access
+  static_assert(bits_per_page > 3, "pages need to hold an 8 byte access");
+  static const register_t bytes_per_page = 1 << bits_per_page;
+  static const register_t tlb_ways       = __tlb_ways;
+  static const register_t tlb_sets       = __tlb_size / __tlb_ways;
+  static_assert(tlb_sets > 0 && (tlb_sets & (tlb_sets - 1)) == 0,
+                "tlb_size / tlb_ways needs to be a power of 2");
+  // never equal to a tag, its offset bits are wider than any access
+  static const register_t invalid_tlb_tag = ~static_cast<register_t>(0);
   const register_t        memory_limit_bytes;
   uint8_t *(*allocate_callback)(void *, uint64_t);
   void (*deallocate_callback)(void *, uint8_t *);
   void           *user_state;
   page_metadata_t default_page_metadata;
+  void (*code_write_callback)(void *, register_t) = nullptr;
+  void *code_write_state                          = nullptr;
+
+  // translations of a single access type, a hit means the access is allowed,
+  // tags are page base addresses and addends are host - guest, tags and
+  // addends are kept apart so the ways of a set are compared in one go
+  struct tlb_t {
+    register_t tags[tlb_sets][tlb_ways];
+    uintptr_t  addends[tlb_sets][tlb_ways];
+  };
 
   constexpr register_t page_number(register_t addr) const {
     return addr >> bits_per_page;
@@ -467,8 +1055,98 @@ struct memory_t {
   constexpr register_t page_offset(register_t addr) const {
     return addr & (bytes_per_page - 1);
   }
-  constexpr register_t cache_index(register_t page_number) const {
-    return page_number % direct_cache_size;
+  constexpr register_t tlb_set(register_t page_number) const {
+    return page_number & (tlb_sets - 1);
+  }
+  // host address of an access of size bytes, nullptr unless the tlb holds
+  // the page and the access is aligned, which keeps it inside the page
+  // Note: the low bits of addr stay in the tag, so a misaligned access never
+  // matches and takes the slow path
+  template <register_t size>
+  inline uint8_t *tlb_lookup(const tlb_t &tlb, register_t addr) const {
+    register_t        tag  = addr & (~(bytes_per_page - 1) | (size - 1));
+    register_t        set  = tlb_set(page_number(addr));
+    const register_t *tags = tlb.tags[set];
+    for (register_t way = 0; way < tlb_ways; way++) {
+      if (tags[way] == tag) [[likely]]
+        return reinterpret_cast<uint8_t *>(addr + tlb.addends[set][way]);
+    }
+    return nullptr;
+  }
+#ifdef DAWN_FLAT_RAM
+  // host address of an access inside the ram window, nullptr for any other
+  // address, a single compare since addresses below ram_base wrap around
+  // Note: ram_limit leaves room for an 8 byte access, the last bytes of the
+  // window are reached through its pages like any other memory
+  inline uint8_t *ram_lookup(register_t addr) const {
+    register_t offset = addr - ram_base;
+    return offset < ram_limit ? ram + offset : nullptr;
+  }
+  // the part of the window a page of it is, nullptr for pages outside of it
+  inline uint8_t *ram_page(register_t page_number) const {
+    register_t offset = (page_number << bits_per_page) - ram_base;
+    return offset < ram_size ? ram_host + offset : nullptr;
+  }
+#endif
+  template <register_t size>
+  inline uint8_t *load_lookup(register_t addr) const {
+#ifdef DAWN_FLAT_RAM
+    if (uint8_t *host = ram_lookup(addr)) [[likely]]
+      return host;
+#endif
+    return tlb_lookup<size>(read_tlb, addr);
+  }
+  template <register_t size>
+  inline uint8_t *fetch_lookup(register_t addr) const {
+    // Note: the sandbox only guards loads and stores, fetches check e_x in the
+    // tlb
+#if defined(DAWN_FLAT_RAM) && !defined(DAWN_SANDBOX)
+    if (uint8_t *host = ram_lookup(addr)) [[likely]]
+      return host;
+#endif
+    return tlb_lookup<size>(fetch_tlb, addr);
+  }
+  template <register_t size>
+  inline uint8_t *store_lookup(register_t addr) const {
+#if defined(DAWN_FLAT_RAM) && \
+    (defined(DAWN_INSTRUCTION_CACHE) || defined(DAWN_PREDECODE))
+    // Note: stores to pages of decoded code take the slow path, which tells
+    // the owner of the code
+    register_t offset = addr - ram_base;
+    if (offset < ram_limit) [[likely]] {
+      register_t first = offset >> bits_per_page;
+      register_t last  = (offset + size - 1) >> bits_per_page;
+      if (!(ram_code[first] | ram_code[last])) [[likely]]
+        return ram + offset;
+    }
+#elif defined(DAWN_FLAT_RAM)
+    if (uint8_t *host = ram_lookup(addr)) [[likely]]
+      return host;
+#endif
+    return tlb_lookup<size>(write_tlb, addr);
+  }
+  // makes page the most recent way of its set, the least recent way is
+  // evicted unless the page is in the set already
+  // Note: a misaligned access misses with its page in the tlb
+  constexpr void tlb_fill(tlb_t &tlb, const page_t &page) {
+    register_t page_number = page.number();
+    register_t set         = tlb_set(page_number);
+    register_t tag         = page_number << bits_per_page;
+    register_t way         = 0;
+    while (way < tlb_ways - 1 && tlb.tags[set][way] != tag) way++;
+    for (; way > 0; way--) {
+      tlb.tags[set][way]    = tlb.tags[set][way - 1];
+      tlb.addends[set][way] = tlb.addends[set][way - 1];
+    }
+    tlb.tags[set][0]    = tag;
+    tlb.addends[set][0] = reinterpret_cast<uintptr_t>(page.ptr) - tag;
+  }
+  constexpr void tlb_flush(tlb_t &tlb, register_t page_number) {
+    register_t set = tlb_set(page_number);
+    for (register_t way = 0; way < tlb_ways; way++) {
+      if (tlb.tags[set][way] == page_number << bits_per_page)
+        tlb.tags[set][way] = invalid_tlb_tag;
+    }
   }
   constexpr uint8_t *allocate_frame() {
     if (allocated_bytes + bytes_per_page > memory_limit_bytes) return nullptr;
@@ -484,6 +1162,17 @@ struct memory_t {
   }
   constexpr page_t allocate_page(register_t      page_number,
                                  page_metadata_t metadata) {
+#if defined(DAWN_SANDBOX)
+    // Note: a page of the window is backed by it, its guest view follows the
+    // metadata once the page is in the page table
+    if (uint8_t *ram_frame = ram_page(page_number))
+      return create_page(page_number, ram_frame, metadata);
+#elif defined(DAWN_FLAT_RAM)
+    // Note: a page of the window is backed by it and is rwx like all of it,
+    // the metadata only shows on the slow path anyway
+    if (uint8_t *ram_frame = ram_page(page_number))
+      return create_page(page_number, ram_frame, page_metadata_t::e_rwx);
+#endif
     uint8_t *new_frame = allocate_frame();
     if (!new_frame) [[unlikely]] {
       return page_t{};
@@ -491,11 +1180,122 @@ struct memory_t {
     return create_page(page_number, new_frame, metadata);
   }
   constexpr void invalidate_caches() {
-    mru_page = fetch_mru_page = page_t{};
-    for (uint32_t i = 0; i < direct_cache_size; i++) {
-      direct_cache[i] = fetch_direct_cache[i] = page_t{};
+    for (tlb_t *tlb : {&read_tlb, &write_tlb, &fetch_tlb})
+      for (auto &set : tlb->tags)
+        for (register_t &tag : set) tag = invalid_tlb_tag;
+  }
+  // tells the owner of the decoded code that a page marked e_c was stored to
+  inline void code_written(register_t page_number) {
+    if (code_write_callback) code_write_callback(code_write_state, page_number);
+  }
+  // drops the cached translations of a single page, for when it or its
+  // metadata changes
+  inline void invalidate_page(register_t page_number) {
+    tlb_flush(read_tlb, page_number);
+    tlb_flush(write_tlb, page_number);
+    tlb_flush(fetch_tlb, page_number);
+#ifdef DAWN_SANDBOX
+    protect_ram_page(page_number);
+#endif
+  }
+#ifdef DAWN_FLAT_RAM
+  // maps size bytes at a huge_page_size aligned host address, the slack of
+  // the reservation it is carved from is given back
+  static void *map_aligned(size_t size, int prot, int flags, int fd) {
+    size_t reserved    = size + huge_page_size;
+    void  *reservation = mmap(nullptr, reserved, PROT_NONE,
+                              MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                              -1, 0);
+    if (reservation == MAP_FAILED) return MAP_FAILED;
+    uint8_t *begin   = static_cast<uint8_t *>(reservation);
+    uint8_t *aligned = reinterpret_cast<uint8_t *>(
+        (reinterpret_cast<uintptr_t>(begin) + huge_page_size - 1) &
+        ~static_cast<uintptr_t>(huge_page_size - 1));
+    if (aligned != begin) munmap(begin, aligned - begin);
+    munmap(aligned + size, begin + reserved - aligned - size);
+    void *ptr = mmap(aligned, size, prot, flags | MAP_FIXED, fd, 0);
+    if (ptr == MAP_FAILED) munmap(aligned, size);
+    return ptr;
+  }
+  // reserves the host range of the window, the host kernel backs its pages
+  // on first touch, base and size have to be page aligned
+  // with huge_pages the window is backed by 2 MB host pages where the host
+  // has them, reserved ones if enough were set aside, transparent ones
+  // otherwise, the guest side needs no page lookups in the window either way
+  bool map_ram(register_t base, register_t size, bool huge_pages) {
+    if (ram || size == 0 || size - 1 > ~base) return false;
+    if (page_offset(base) || page_offset(size)) return false;
+#ifdef DAWN_SANDBOX
+    // two views of one memfd, the guest view only allows what the page table
+    // allows and the host view is for everything else
+    if (bytes_per_page % sysconf(_SC_PAGESIZE)) return false;
+    int fd = memfd_create("dawn", MFD_CLOEXEC);
+    if (fd < 0) return false;
+    void *ptr  = MAP_FAILED;
+    void *host = MAP_FAILED;
+    if (ftruncate(fd, size) == 0) {
+      ptr  = map_aligned(size, PROT_NONE, MAP_SHARED, fd);
+      host = map_aligned(size, PROT_READ | PROT_WRITE, MAP_SHARED, fd);
+    }
+    close(fd);
+    if (ptr == MAP_FAILED || host == MAP_FAILED) {
+      if (ptr != MAP_FAILED) munmap(ptr, size);
+      if (host != MAP_FAILED) munmap(host, size);
+      return false;
+    }
+    // Note: reserved huge pages cannot be protected a page at a time, the
+    // sandbox only asks for transparent ones
+    if (huge_pages) {
+      madvise(ptr, size, MADV_HUGEPAGE);
+      madvise(host, size, MADV_HUGEPAGE);
     }
+    install_sandbox_handler();
+    ram_host = static_cast<uint8_t *>(host);
+#else
+    void *ptr = MAP_FAILED;
+    // Note: reserved huge pages are accounted for when the window is mapped,
+    // the mapping fails unless the host set enough of them aside
+    if (huge_pages && size % huge_page_size == 0)
+      ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (ptr == MAP_FAILED) {
+      ptr = map_aligned(size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1);
+      if (ptr == MAP_FAILED) return false;
+      if (huge_pages) madvise(ptr, size, MADV_HUGEPAGE);
+    }
+    ram_host = static_cast<uint8_t *>(ptr);
+#endif
+    ram       = static_cast<uint8_t *>(ptr);
+    ram_base  = base;
+    ram_size  = size;
+    ram_limit = size - 7;
+#if defined(DAWN_INSTRUCTION_CACHE) || defined(DAWN_PREDECODE)
+    ram_code.assign(size >> bits_per_page, 0);
+#endif
+    return true;
+  }
+#if defined(DAWN_INSTRUCTION_CACHE) || defined(DAWN_PREDECODE)
+  inline void mark_ram_code(register_t page_number, bool code) {
+    register_t offset = (page_number << bits_per_page) - ram_base;
+    if (offset < ram_size) ram_code[offset >> bits_per_page] = code;
+  }
+#endif
+#ifdef DAWN_SANDBOX
+  // the guest view of a page of the window allows what its entry allows
+  // Note: the host mmu has no write only pages, they are readable as well
+  inline void protect_ram_page(register_t page_number) {
+    register_t offset = (page_number << bits_per_page) - ram_base;
+    if (offset >= ram_size) return;
+    page_t *entry = page_table.find(page_number);
+    int     prot  = PROT_NONE;
+    if (entry && entry->has_metadata(page_metadata_t::e_r)) prot |= PROT_READ;
+    if (entry && entry->has_metadata(page_metadata_t::e_w))
+      prot |= PROT_READ | PROT_WRITE;
+    mprotect(ram + offset, bytes_per_page, prot);
   }
+#endif
+#endif
 
   memory_t(register_t memory_limit_bytes, void *user_state,
            uint8_t *(*allocate_callback)(void *, uint64_t),
@@ -505,41 +1305,51 @@ struct memory_t {
         user_state(user_state),
         allocate_callback(allocate_callback),
         deallocate_callback(deallocate_callback),
-        default_page_metadata(default_page_metadata) {}
-
-  register_t allocated_bytes                         = 0;
-  page_t     mru_page                                = {};
-  page_t     direct_cache[__direct_cache_size]       = {};
-  page_t     fetch_mru_page                          = {};
-  page_t     fetch_direct_cache[__direct_cache_size] = {};
-  // page_number -> page
-  // TODO: try some faster map implementations
-  std::unordered_map<register_t, page_t> page_table;
+        default_page_metadata(default_page_metadata) {
+    invalidate_caches();
+  }
+#ifdef DAWN_FLAT_RAM
+  ~memory_t() {
+    if (ram) munmap(ram, ram_size);
+#ifdef DAWN_SANDBOX
+    if (ram_host) munmap(ram_host, ram_size);
+#endif
+  }
+#endif
+
+  register_t allocated_bytes = 0;
+  // Note: mmio pages are never in a tlb, code pages never in write_tlb, so
+  // a hit is always plain memory
+  tlb_t read_tlb;
+  tlb_t write_tlb;
+  tlb_t fetch_tlb;
+  page_table_t<__bits_per_page> page_table;
+#ifdef DAWN_FLAT_RAM
+  // host pages the window can be backed by with huge_pages
+  static const size_t huge_page_size = 1 << 21;
+  // the ram window, empty until map_ram, ram is what guest accesses go
+  // through and ram_host backs the pages, the same mapping unless sandboxed
+  uint8_t   *ram       = nullptr;
+  uint8_t   *ram_host  = nullptr;
+  register_t ram_base  = 0;
+  register_t ram_size  = 0;
+  register_t ram_limit = 0;
+#if defined(DAWN_INSTRUCTION_CACHE) || defined(DAWN_PREDECODE)
+  // a byte per page of the window, set while the page is marked e_c
+  std::vector<uint8_t> ram_code;
+#endif
+#endif
 };
 
-template <size_t direct_cache_size, size_t bits_per_page>
-page_t slow_get_page_fetch(memory_t<direct_cache_size, bits_per_page> &memory,
-                           register_t                                  addr) {
+template <size_t tlb_size, size_t bits_per_page, size_t tlb_ways>
+page_t slow_get_page_fetch(
+    memory_t<tlb_size, bits_per_page, tlb_ways> &memory, register_t addr) {
   register_t page_number = memory.page_number(addr);
-  register_t cache_index = memory.cache_index(page_number);
   page_t     page{};
-  if (memory.fetch_direct_cache[cache_index].number() == page_number)
-      [[likely]] {
-    if (memory.fetch_direct_cache[cache_index].has_metadata(
-            page_metadata_t::e_x)) [[likely]] {
-      memory.fetch_mru_page = memory.fetch_direct_cache[cache_index];
-      page                  = memory.fetch_mru_page;
-    } else {
-      page = {};
-    }
-    return page;
-  }
-  auto itr = memory.page_table.find(page_number);
-  if (itr != memory.page_table.end()) [[likely]] {
-    if (itr->second.has_metadata(page_metadata_t::e_x)) [[likely]] {
-      memory.fetch_mru_page                  = itr->second;
-      memory.fetch_direct_cache[cache_index] = itr->second;
-      page                                   = memory.fetch_mru_page;
+  page_t    *entry       = memory.page_table.find(page_number);
+  if (entry) [[likely]] {
+    if (entry->has_metadata(page_metadata_t::e_x)) [[likely]] {
+      page = *entry;
     } else {
       page = {};
     }
@@ -552,57 +1362,31 @@ page_t slow_get_page_fetch(memory_t<direct_cache_size, bits_per_page> &memory,
     page = {};
     return page;
   }
-  memory.page_table[page_number]         = new_page;
-  memory.fetch_direct_cache[cache_index] = new_page;
-  memory.fetch_mru_page                  = new_page;
+  memory.page_table[page_number] = new_page;
+#ifdef DAWN_SANDBOX
+  memory.invalidate_page(page_number);
+#endif
   if (new_page.has_metadata(page_metadata_t::e_x)) [[likely]]
-    page = memory.fetch_mru_page;
+    page = new_page;
   else
     page = {};
   return page;
 }
 
-#define __get_page_fetch(__memory, __addr, __page)                          \
-  do {                                                                      \
-    register_t __page_number = __memory.page_number(__addr);                \
-    /* mru */                                                               \
-    if (__memory.fetch_mru_page.number() == __page_number) [[likely]] {     \
-      /* Note: saving cycles, maybe dont hide ? */                          \
-      assert(__memory.fetch_mru_page.has_metadata(page_metadata_t::e_x));   \
-      /* if (__memory.fetch_mru_page.has_metadata(page_metadata_t::e_x)) */ \
-      /*[[likely]]*/                                                        \
-      __page = __memory.fetch_mru_page;                                     \
-      /*else*/                                                              \
-      /*__page = {};*/                                                      \
-      break;                                                                \
-    }                                                                       \
-    register_t __cache_index = __memory.cache_index(__page_number);         \
-    /* cache */                                                             \
-    /* page_table */                                                        \
-    __page = slow_get_page_fetch(__memory, __addr);                         \
+#define __get_page_fetch(__memory, __addr, __page)  \
+  do {                                              \
+    __page = slow_get_page_fetch(__memory, __addr); \
   } while (false)
 
-template <size_t direct_cache_size, size_t bits_per_page>
-page_t slow_get_page(memory_t<direct_cache_size, bits_per_page> &memory,
+template <size_t tlb_size, size_t bits_per_page, size_t tlb_ways>
+page_t slow_get_page(memory_t<tlb_size, bits_per_page, tlb_ways> &memory,
                      page_metadata_t metadata, register_t addr) {
   register_t page_number = memory.page_number(addr);
-  register_t cache_index = memory.cache_index(page_number);
   page_t     page{};
-  if (memory.direct_cache[cache_index].number() == page_number) [[likely]] {
-    if (memory.direct_cache[cache_index].has_metadata(metadata)) [[likely]] {
-      memory.mru_page = memory.direct_cache[cache_index];
-      page            = memory.mru_page;
-    } else {
-      page = {};
-    }
-    return page;
-  }
-  auto itr = memory.page_table.find(page_number);
-  if (itr != memory.page_table.end()) [[likely]] {
-    if (itr->second.has_metadata(metadata)) [[likely]] {
-      memory.direct_cache[cache_index] = itr->second;
-      memory.mru_page                  = itr->second;
-      page                             = memory.mru_page;
+  page_t    *entry       = memory.page_table.find(page_number);
+  if (entry) [[likely]] {
+    if (entry->has_metadata(metadata)) [[likely]] {
+      page = *entry;
     } else {
       page = {};
     }
@@ -616,36 +1400,26 @@ page_t slow_get_page(memory_t<direct_cache_size, bits_per_page> &memory,
     return page;
   }
   if (new_page.has_metadata(metadata)) [[likely]] {
-    memory.page_table[page_number]   = new_page;
-    memory.direct_cache[cache_index] = new_page;
-    memory.mru_page                  = new_page;
-    page                             = memory.mru_page;
+    memory.page_table[page_number] = new_page;
+    page                           = new_page;
+#ifdef DAWN_SANDBOX
+    memory.invalidate_page(page_number);
+#endif
   } else {
     page = {};
   }
   return page;
 }
-#define __get_page(__memory, __metadata, __addr, __page)            \
-  do {                                                              \
-    register_t __page_number = __memory.page_number(__addr);        \
-    /* mru */                                                       \
-    if (__memory.mru_page.number() == __page_number) [[likely]] {   \
-      if (__memory.mru_page.has_metadata(__metadata)) [[likely]]    \
-        __page = __memory.mru_page;                                 \
-      else                                                          \
-        __page = {};                                                \
-      break;                                                        \
-    }                                                               \
-    register_t __cache_index = __memory.cache_index(__page_number); \
-    /* cache */                                                     \
-    /* page_table */                                                \
-    __page = slow_get_page(__memory, __metadata, __addr);           \
+#define __get_page(__memory, __metadata, __addr, __page)  \
+  do {                                                    \
+    __page = slow_get_page(__memory, __metadata, __addr); \
   } while (false)
 
 // TODO: maybe make all load/store/fetch straddling into 1 function ?
-template <typename type, size_t direct_cache_size, size_t bits_per_page>
+template <typename type, size_t tlb_size, size_t bits_per_page,
+          size_t tlb_ways>
 std::pair<bool, type> load_straddling(
-    memory_t<direct_cache_size, bits_per_page> &memory, register_t addr) {
+    memory_t<tlb_size, bits_per_page, tlb_ways> &memory, register_t addr) {
   type                 value        = 0;
   uint8_t             *value_ptr    = reinterpret_cast<uint8_t *>(&value);
   constexpr register_t type_size    = sizeof(type);
@@ -666,37 +1440,52 @@ std::pair<bool, type> load_straddling(
   return {true, value};
 }
 
+// every load the tlb does not answer, fills the tlb for the next one
+template <typename type, size_t tlb_size, size_t bits_per_page,
+          size_t tlb_ways>
+std::pair<bool, type> load_slow(
+    memory_t<tlb_size, bits_per_page, tlb_ways> &memory, register_t addr) {
+  type   value = 0;
+  page_t page;
+  __get_page(memory, page_metadata_t::e_r, addr, page);
+  if (!page.ptr) return {false, value};
+  if (page.has_metadata(page_metadata_t::e_m)) [[unlikely]] {
+    mmio_page_data_t *mmio_page_data =
+        reinterpret_cast<mmio_page_data_t *>(page.ptr);
+    return {true,
+            static_cast<type>(mmio_page_data_load(*mmio_page_data, addr))};
+  }
+  memory.tlb_fill(memory.read_tlb, page);
+  register_t offset = memory.page_offset(addr);
+  if (offset + sizeof(type) > memory.bytes_per_page) [[unlikely]] {
+    /* straddling access */
+    return load_straddling<type>(memory, addr);
+  }
+  /* single page access */
+  std::memcpy(&value, static_cast<uint8_t *>(page.ptr) + offset, sizeof(type));
+  return {true, value};
+}
+
 #define __load(__type, __memory, __addr, __value)                             \
   do {                                                                        \
-    constexpr register_t __type_size   = sizeof(__type);                      \
-    register_t           __page_number = __memory.page_number(__addr);        \
-    register_t           __offset      = __memory.page_offset(__addr);        \
-    page_t               __page;                                              \
-    uint8_t             *__value_ptr = reinterpret_cast<uint8_t *>(&__value); \
-    __get_page(__memory, page_metadata_t::e_r, __addr, __page);               \
-    if (!__page.ptr) do_trap(exception_code_t::e_load_access_fault, __addr);  \
-    if (__page.has_metadata(page_metadata_t::e_m)) [[unlikely]] {             \
-      mmio_page_data_t *mmio_page_data =                                      \
-          reinterpret_cast<mmio_page_data_t *>(__page.ptr);                   \
-      __value = mmio_page_data_load(*mmio_page_data, __addr);                 \
-    } else if (__offset + __type_size > __memory.bytes_per_page)              \
-        [[unlikely]] {                                                        \
-      /* straddling access */                                                 \
-      auto __straddling_result = load_straddling<__type>(__memory, __addr);   \
-      if (!__straddling_result.first) {                                       \
-        do_trap(exception_code_t::e_load_access_fault, __addr);               \
-      }                                                                       \
-      __value = __straddling_result.second;                                   \
-    } else {                                                                  \
-      /* single page access */                                                \
-      std::memcpy(__value_ptr, static_cast<uint8_t *>(__page.ptr) + __offset, \
-                  __type_size);                                               \
+    const uint8_t *__host =                                                   \
+        __memory.template load_lookup<sizeof(__type)>(__addr);                \
+    if (__host) [[likely]] {                                                  \
+      __type __loaded;                                                        \
+      std::memcpy(&__loaded, __host, sizeof(__type));                         \
+      __value = __loaded;                                                     \
+      break;                                                                  \
     }                                                                         \
+    auto __result = load_slow<__type>(__memory, __addr);                      \
+    if (!__result.first)                                                      \
+      do_trap(exception_code_t::e_load_access_fault, __addr);                 \
+    __value = __result.second;                                                \
   } while (false)
 
-template <typename type, size_t direct_cache_size, size_t bits_per_page>
+template <typename type, size_t tlb_size, size_t bits_per_page,
+          size_t tlb_ways>
 std::pair<bool, type> fetch_straddling(
-    memory_t<direct_cache_size, bits_per_page> &memory, register_t addr) {
+    memory_t<tlb_size, bits_per_page, tlb_ways> &memory, register_t addr) {
   type                 value        = 0;
   uint8_t             *value_ptr    = reinterpret_cast<uint8_t *>(&value);
   constexpr register_t type_size    = sizeof(type);
@@ -717,43 +1506,49 @@ std::pair<bool, type> fetch_straddling(
   return {true, value};
 }
 
+// every fetch the tlb does not answer, fills the tlb for the next one
+template <typename type, size_t tlb_size, size_t bits_per_page,
+          size_t tlb_ways>
+std::pair<bool, type> fetch_slow(
+    memory_t<tlb_size, bits_per_page, tlb_ways> &memory, register_t addr) {
+  type   value = 0;
+  page_t page;
+  __get_page_fetch(memory, addr, page);
+  if (!page.ptr) return {false, value};
+  /* Note: ignoring fetch for mmio to be more performant */
+  /* TODO: maybe dont ignore ? and do a guest trap ? */
+  assert(!page.has_metadata(page_metadata_t::e_m));
+  memory.tlb_fill(memory.fetch_tlb, page);
+  register_t offset = memory.page_offset(addr);
+  /* TODO: test without straddling accesses, I dont think this is possible */
+  if (offset + sizeof(type) > memory.bytes_per_page) [[unlikely]] {
+    /* straddling access */
+    return fetch_straddling<type>(memory, addr);
+  }
+  /* single page access */
+  std::memcpy(&value, static_cast<uint8_t *>(page.ptr) + offset, sizeof(type));
+  return {true, value};
+}
+
 #define __fetch(__type, __memory, __addr, __value)                            \
   do {                                                                        \
-    constexpr register_t __type_size   = sizeof(__type);                      \
-    register_t           __page_number = __memory.page_number(__addr);        \
-    register_t           __offset      = __memory.page_offset(__addr);        \
-    page_t               __page;                                              \
-    uint8_t             *__value_ptr = reinterpret_cast<uint8_t *>(&__value); \
-    __get_page_fetch(__memory, __addr, __page);                               \
-    if (!__page.ptr)                                                          \
-      do_trap(exception_code_t::e_instruction_access_fault, __addr);          \
-    /* Note: ignoring fetch for mmio to be more performant */                 \
-    /* TODO: maybe dont ignore ? and do a guest trap ? */                     \
-    assert(!__page.has_metadata(page_metadata_t::e_m));                       \
-    /* if (__page.has_metadata(page_metadata_t::e_m)) [[unlikely]] {          \
-      mmio_page_data_t *mmio_page_data =                                      \
-          reinterpret_cast<mmio_page_data_t *>(__page.ptr);                   \
-      __value = static_cast<__type>(                                          \
-          mmio_page_data_load64(*mmio_page_data, __addr));                    \
-    } else */                                                                 \
-    /* TODO: test without straddling accesses, I dont think this is possible  \
-     */                                                                       \
-    if (__offset + __type_size > __memory.bytes_per_page) [[unlikely]] {      \
-      /* straddling access */                                                 \
-      auto __straddling_result = fetch_straddling<__type>(__memory, __addr);  \
-      if (!__straddling_result.first) {                                       \
-        do_trap(exception_code_t::e_instruction_access_fault, __addr);        \
-      }                                                                       \
-      __value = __straddling_result.second;                                   \
-    } else {                                                                  \
-      /* single page access */                                                \
-      std::memcpy(__value_ptr, static_cast<uint8_t *>(__page.ptr) + __offset, \
-                  __type_size);                                               \
+    const uint8_t *__host =                                                   \
+        __memory.template fetch_lookup<sizeof(__type)>(__addr);               \
+    if (__host) [[likely]] {                                                  \
+      __type __fetched;                                                       \
+      std::memcpy(&__fetched, __host, sizeof(__type));                        \
+      __value = __fetched;                                                    \
+      break;                                                                  \
     }                                                                         \
+    auto __result = fetch_slow<__type>(__memory, __addr);                     \
+    if (!__result.first)                                                      \
+      do_trap(exception_code_t::e_instruction_access_fault, __addr);          \
+    __value = __result.second;                                                \
   } while (false)
 
-template <typename type, size_t direct_cache_size, size_t bits_per_page>
-bool store_straddling(memory_t<direct_cache_size, bits_per_page> &memory,
+template <typename type, size_t tlb_size, size_t bits_per_page,
+          size_t tlb_ways>
+bool store_straddling(memory_t<tlb_size, bits_per_page, tlb_ways> &memory,
                       register_t addr, register_t value) {
   constexpr register_t type_size   = sizeof(type);
   register_t           page_number = memory.page_number(addr);
@@ -784,39 +1579,53 @@ bool store_straddling(memory_t<direct_cache_size, bits_per_page> &memory,
     if (chunk_size > remaining) chunk_size = remaining;
     std::memcpy(static_cast<uint8_t *>(page.ptr) + current_offset,
                 value_ptr + (type_size - remaining), chunk_size);
+    if (page.has_metadata(page_metadata_t::e_c)) [[unlikely]]
+      memory.code_written(memory.page_number(current_addr));
     current_addr += chunk_size;
     remaining -= chunk_size;
   }
   return true;
 }
 
+// every store the tlb does not answer, pages of decoded code and mmio never
+// get into write_tlb so stores to them always come here
+template <typename type, size_t tlb_size, size_t bits_per_page,
+          size_t tlb_ways>
+bool store_slow(memory_t<tlb_size, bits_per_page, tlb_ways> &memory,
+                register_t addr, register_t value) {
+  page_t page;
+  __get_page(memory, page_metadata_t::e_w, addr, page);
+  if (!page.ptr) return false;
+  if (page.has_metadata(page_metadata_t::e_m)) [[unlikely]] {
+    mmio_page_data_t *mmio_page_data =
+        reinterpret_cast<mmio_page_data_t *>(page.ptr);
+    mmio_page_data_store(*mmio_page_data, addr, value);
+    return true;
+  }
+  if (!page.has_metadata(page_metadata_t::e_c))
+    memory.tlb_fill(memory.write_tlb, page);
+  register_t offset = memory.page_offset(addr);
+  if (page.has_metadata(page_metadata_t::e_c) ||
+      offset + sizeof(type) > memory.bytes_per_page) [[unlikely]] {
+    /* straddling access, or a code page that drops the decoded code */
+    return store_straddling<type>(memory, addr, value);
+  }
+  /* single page access */
+  const type stored = value;
+  std::memcpy(static_cast<uint8_t *>(page.ptr) + offset, &stored, sizeof(type));
+  return true;
+}
+
 #define __store(__type, __memory, __addr, __value)                            \
   do {                                                                        \
-    constexpr register_t __type_size   = sizeof(__type);                      \
-    register_t           __page_number = __memory.page_number(__addr);        \
-    register_t           __offset      = __memory.page_offset(__addr);        \
-    page_t               __page;                                              \
-    const __type         _value = __value;                                    \
-    const uint8_t *__value_ptr  = reinterpret_cast<const uint8_t *>(&_value); \
-    __get_page(__memory, page_metadata_t::e_w, __addr, __page);               \
-    if (!__page.ptr) do_trap(exception_code_t::e_store_access_fault, __addr); \
-    if (__page.has_metadata(page_metadata_t::e_m)) [[unlikely]] {             \
-      mmio_page_data_t *mmio_page_data =                                      \
-          reinterpret_cast<mmio_page_data_t *>(__page.ptr);                   \
-      mmio_page_data_store(*mmio_page_data, __addr, __value);                 \
-    } else if (__offset + __type_size > __memory.bytes_per_page)              \
-        [[unlikely]] {                                                        \
-      /* straddling access */                                                 \
-      auto __should_trap =                                                    \
-          store_straddling<__type>(__memory, __addr, __value);                \
-      if (!__should_trap) {                                                   \
-        do_trap(exception_code_t::e_store_access_fault, __addr);              \
-      }                                                                       \
-    } else {                                                                  \
-      /* single page access */                                                \
-      std::memcpy(static_cast<uint8_t *>(__page.ptr) + __offset, __value_ptr, \
-                  __type_size);                                               \
+    uint8_t *__host = __memory.template store_lookup<sizeof(__type)>(__addr); \
+    if (__host) [[likely]] {                                                  \
+      const __type __stored = __value;                                        \
+      std::memcpy(__host, &__stored, sizeof(__type));                         \
+      break;                                                                  \
     }                                                                         \
+    if (!store_slow<__type>(__memory, __addr, __value))                       \
+      do_trap(exception_code_t::e_store_access_fault, __addr);                \
   } while (false)
 
 // TODO: flip value and addr locations in macro
@@ -858,82 +1667,909 @@ bool store_straddling(memory_t<direct_cache_size, bits_per_page> &memory,
 typedef void (*trap_callback_t)(void *, exception_code_t cause,
                                 register_t value);
 
-// TODO: accurate runtime memory bounds checking (account for size of
-// load/store)
-template <size_t direct_cache_size, size_t bits_per_page>
-struct machine_t {
-  machine_t(size_t ram_size, const std::vector<mmio_handler_t> mmios,
-            void *user_state, uint8_t *(*allocate_callback)(void *, uint64_t),
-            void (*deallocate_callback)(void *, uint8_t *),
-            page_metadata_t default_page_metadata)
-      : _memory(ram_size, user_state, allocate_callback, deallocate_callback,
-                default_page_metadata),
-        _mmios(mmios) {
-    for (const auto &mmio : mmios) {
-      register_t start = _memory.page_number(mmio.start);
-      register_t stop  = _memory.page_number(mmio.stop - 1);
+#if defined(DAWN_PREDECODE) && defined(DAWN_INSTRUCTION_CACHE)
+static_assert(false, "DAWN_PREDECODE replaces DAWN_INSTRUCTION_CACHE");
+#endif
 
-      page_t page;
-      for (; start <= stop; start++) {
-        auto itr = _memory.page_table.find(start);
-        if (itr == _memory.page_table.end()) {
-          page.descriptor                  = start | page_metadata_t::e_rwm;
-          mmio_page_data_t &mmio_page_data = _mmio_page_data.emplace_back();
-          page.ptr                         = &mmio_page_data;
-          _memory.page_table[start]        = page;
-        } else {
-          page = itr->second;
-        }
-        mmio_page_data_t &mmio_page_data =
-            *reinterpret_cast<mmio_page_data_t *>(page.ptr);
-        mmio_page_data.mmios.push_back(mmio);
-      }
+#ifdef DAWN_JIT
+#if !defined(__x86_64__) || !defined(DAWN_RISCV64) || \
+    !defined(DAWN_INSTRUCTION_CACHE)
+static_assert(false,
+              "DAWN_JIT needs an x86-64 host, DAWN_RISCV64 and "
+              "DAWN_INSTRUCTION_CACHE");
+#endif
+
+// a compiled block runs from the first instruction of its block and returns
+// the index of the first instruction it did not run, pc is written back for
+// that instruction, returning the block size means pc is the next block
+typedef uint64_t (*native_block_t)(register_t *reg, register_t *pc,
+                                   void *machine);
+#endif
+
+#ifdef DAWN_AOT
+#ifndef DAWN_INSTRUCTION_CACHE
+static_assert(false, "DAWN_AOT needs DAWN_INSTRUCTION_CACHE");
+#endif
+#endif
+
+#if defined(DAWN_JIT) || defined(DAWN_AOT)
+// compiled code accesses memory through the machine, these return false
+// instead of trapping so that the interpreter can run the instruction again
+typedef bool (*jit_load_t)(void *machine, register_t addr, register_t *value);
+typedef bool (*jit_store_t)(void *machine, register_t addr, register_t value);
+
+struct jit_helpers_t {
+  jit_load_t  load[8];   // indexed by funct3
+  jit_store_t store[8];  // indexed by funct3
+};
+#endif
+
+#ifdef DAWN_AOT
+// code translated ahead of time by examples/aot, a region is a run of
+// instructions up to and including the first one that ends a block
+// Note: a region runs from *pc, any instruction of the region, until it ran n
+// instructions, reached the end of the region or an instruction it does not
+// translate, it returns how many it ran and writes pc back for the next one
+typedef uint64_t (*aot_region_fn_t)(register_t *reg, register_t *pc,
+                                    void *machine, const jit_helpers_t *helpers,
+                                    uint64_t n);
+
+struct aot_region_t {
+  register_t      start;
+  register_t      end;   // one past the last instruction
+  const uint32_t *code;  // the instructions it was translated from
+  aot_region_fn_t run;
+};
+
+// bumped whenever aot_module_t, aot_region_t or aot_region_fn_t change
+constexpr uint32_t aot_module_version = 2;
+
+// the only symbol a translated module exports, as dawn_aot_module
+struct aot_module_t {
+  uint32_t            version;
+  uint32_t            xlen;
+  uint64_t            key;  // aot_key_t of the code it was translated from
+  uint64_t            num_regions;
+  const aot_region_t *regions;  // sorted by start, not overlapping
+};
+
+// names the code of an elf, its executable segments are added in program
+// header order, modules in a cache directory are named after it
+// Note: fnv-1a, only meant to tell builds of a script apart
+struct aot_key_t {
+  void add(register_t address, const void *data, size_t size) {
+    add_bytes(&address, sizeof(address));
+    uint64_t size64 = size;
+    add_bytes(&size64, sizeof(size64));
+    add_bytes(data, size);
+  }
+  void add_bytes(const void *data, size_t size) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++) value = (value ^ bytes[i]) * 0x100000001b3;
+  }
+  // file name of the module in a cache directory
+  std::string file_name() const {
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << value << ".so";
+    return ss.str();
+  }
+
+  uint64_t value = 0xcbf29ce484222325;
+};
+
+// owns a dlopen'ed module
+struct aot_library_t {
+  aot_library_t() = default;
+  ~aot_library_t() {
+    if (handle) dlclose(handle);
+  }
+  aot_library_t(const aot_library_t &)            = delete;
+  aot_library_t &operator=(const aot_library_t &) = delete;
+
+  // the region that holds pc, nullptr if there is none
+  const aot_region_t *find(register_t pc) const {
+    if (!module) return nullptr;
+    const aot_region_t *regions = module->regions;
+    uint64_t            low = 0, high = module->num_regions;
+    while (low < high) {
+      uint64_t middle = low + (high - low) / 2;
+      if (regions[middle].end <= pc)
+        low = middle + 1;
+      else
+        high = middle;
     }
+    if (low == module->num_regions || regions[low].start > pc) return nullptr;
+    return &regions[low];
   }
-  ~machine_t() {}
 
-  // TODO: a more involved csr read
-  inline register_t read_csr(uint16_t csrno, std::memory_order memory_order =
-                                                 std::memory_order::relaxed) {
-    return _csr[csrno].load(memory_order);
+  void               *handle = nullptr;
+  const aot_module_t *module = nullptr;
+};
+#endif
+
+#ifdef DAWN_JIT
+
+// executable memory for compiled blocks, it is only ever reset as a whole,
+// together with the blocks that point into it
+struct code_cache_t {
+  code_cache_t(size_t capacity) : capacity(capacity) {
+    void *ptr = mmap(nullptr, capacity, PROT_READ | PROT_WRITE | PROT_EXEC,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ptr == MAP_FAILED)
+      throw std::runtime_error("failed to map jit code cache");
+    base = static_cast<uint8_t *>(ptr);
   }
-  // TODO: a more involved csr write
-  inline void write_csr(
-      uint16_t csrno, register_t value,
-      std::memory_order memory_order = std::memory_order_relaxed) {
-    _csr[csrno].store(value, memory_order);
+  ~code_cache_t() { munmap(base, capacity); }
+  code_cache_t(const code_cache_t &)            = delete;
+  code_cache_t &operator=(const code_cache_t &) = delete;
+
+  uint8_t *base;
+  size_t   capacity;
+  size_t   used = 0;
+};
+
+// only the x86-64 encodings the jit emits
+// Note: rbx holds reg, r13 holds pc and r12 holds machine for the whole block,
+// everything else is scratch
+struct x86_64_emitter_t {
+  enum gpr_t : uint8_t {
+    rax = 0,
+    rcx = 1,
+    rdx = 2,
+    rbx = 3,
+    rsi = 6,
+    rdi = 7,
+    r12 = 12,
+    r13 = 13,
+  };
+  enum alu_t : uint8_t {
+    e_add = 0,
+    e_or  = 1,
+    e_and = 4,
+    e_sub = 5,
+    e_xor = 6,
+    e_cmp = 7,
+  };
+  enum shift_t : uint8_t {
+    e_shl = 4,
+    e_shr = 5,
+    e_sar = 7,
+  };
+  enum condition_t : uint8_t {
+    e_b  = 0x2,
+    e_ae = 0x3,
+    e_e  = 0x4,
+    e_ne = 0x5,
+    e_l  = 0xc,
+    e_ge = 0xd,
+  };
+
+  void u8(uint8_t value) { *cursor++ = value; }
+  void u32(uint32_t value) {
+    std::memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
   }
-  // TODO: a more involved csr fetch or
-  inline void fetch_or_csr(
-      uint16_t csrno, register_t value,
-      std::memory_order memory_order = std::memory_order::relaxed) {
-    register_t current = _csr[csrno].load(std::memory_order::relaxed);
-    if ((current & value) != value) _csr[csrno].fetch_or(value, memory_order);
+  void u64(uint64_t value) {
+    std::memcpy(cursor, &value, sizeof(value));
+    cursor += sizeof(value);
   }
-  // TODO: a more involved csr fetch and
-  inline void fetch_and_csr(
-      uint16_t csrno, register_t value,
-      std::memory_order memory_order = std::memory_order::relaxed) {
-    register_t current = _csr[csrno].load(std::memory_order::relaxed);
-    if ((current & ~value) != 0) _csr[csrno].fetch_and(value, memory_order);
+  void rex(bool wide, uint8_t reg, uint8_t rm) {
+    uint8_t prefix = 0x40 | (wide << 3) | ((reg >> 3) << 2) | (rm >> 3);
+    if (prefix != 0x40) u8(prefix);
+  }
+  // register to register modrm
+  void modrm(uint8_t reg, uint8_t rm) { u8(0xc0 | (reg & 7) << 3 | (rm & 7)); }
+  // modrm for [rbx + 8 * index]
+  void modrm_guest(uint8_t reg, uint32_t index) {
+    uint32_t disp = index * sizeof(register_t);
+    if (disp < 0x80) {
+      u8(0x40 | (reg & 7) << 3 | rbx);
+      u8(disp);
+    } else {
+      u8(0x80 | (reg & 7) << 3 | rbx);
+      u32(disp);
+    }
   }
 
-  inline bool memcpy_host_to_guest(register_t dst_addr, const void *src_ptr,
-                                   size_t size) {
-    register_t     remaining    = size;
-    register_t     current_addr = dst_addr;
-    const uint8_t *src          = reinterpret_cast<const uint8_t *>(src_ptr);
-    while (remaining > 0) {
-      page_t page;
-      __get_page(_memory, page_metadata_t::e_mask, current_addr, page);
-      if (!page.ptr) return false;
-      if (page.has_metadata(page_metadata_t::e_m))
-        throw std::runtime_error("cannot memcpy_host_to_guest mmio");
-      register_t offset     = _memory.page_offset(current_addr);
-      register_t chunk_size = _memory.bytes_per_page - offset;
+  // mov gpr, reg[index]
+  void load_guest(gpr_t gpr, uint32_t index) {
+    rex(true, gpr, rbx);
+    u8(0x8b);
+    modrm_guest(gpr, index);
+  }
+  // mov reg[index], gpr
+  void store_guest(uint32_t index, gpr_t gpr) {
+    rex(true, gpr, rbx);
+    u8(0x89);
+    modrm_guest(gpr, index);
+  }
+  // lea gpr, reg[index]
+  void address_guest(gpr_t gpr, uint32_t index) {
+    rex(true, gpr, rbx);
+    u8(0x8d);
+    modrm_guest(gpr, index);
+  }
+  // mov [r13], gpr
+  void store_pc(gpr_t gpr) {
+    rex(true, gpr, r13);
+    u8(0x89);
+    u8(0x40 | (gpr & 7) << 3 | (r13 & 7));
+    u8(0);
+  }
+  void mov(gpr_t dst, gpr_t src) {
+    rex(true, src, dst);
+    u8(0x89);
+    modrm(src, dst);
+  }
+  void mov_imm(gpr_t gpr, uint64_t value) {
+    if (static_cast<int64_t>(value) == static_cast<int32_t>(value)) {
+      rex(true, 0, gpr);
+      u8(0xc7);
+      modrm(0, gpr);
+      u32(value);
+    } else if (value <= std::numeric_limits<uint32_t>::max()) {
+      rex(false, 0, gpr);
+      u8(0xb8 | (gpr & 7));
+      u32(value);
+    } else {
+      rex(true, 0, gpr);
+      u8(0xb8 | (gpr & 7));
+      u64(value);
+    }
+  }
+  void alu(alu_t op, bool wide, gpr_t dst, gpr_t src) {
+    rex(wide, src, dst);
+    u8(op << 3 | 0x01);
+    modrm(src, dst);
+  }
+  void alu_imm(alu_t op, bool wide, gpr_t dst, int32_t value) {
+    rex(wide, 0, dst);
+    u8(0x81);
+    modrm(op, dst);
+    u32(value);
+  }
+  void shift_imm(shift_t op, bool wide, gpr_t dst, uint8_t shamt) {
+    rex(wide, 0, dst);
+    u8(0xc1);
+    modrm(op, dst);
+    u8(shamt);
+  }
+  // shift by cl
+  void shift(shift_t op, bool wide, gpr_t dst) {
+    rex(wide, 0, dst);
+    u8(0xd3);
+    modrm(op, dst);
+  }
+  void imul(bool wide, gpr_t dst, gpr_t src) {
+    rex(wide, dst, src);
+    u8(0x0f);
+    u8(0xaf);
+    modrm(dst, src);
+  }
+  // movsxd dst, src32
+  void sign_extend_32(gpr_t dst, gpr_t src) {
+    rex(true, dst, src);
+    u8(0x63);
+    modrm(dst, src);
+  }
+  // setcc al, movzx eax, al
+  void set_rax(condition_t condition) {
+    u8(0x0f);
+    u8(0x90 | condition);
+    modrm(0, rax);
+    u8(0x0f);
+    u8(0xb6);
+    modrm(rax, rax);
+  }
+  void cmov(condition_t condition, gpr_t dst, gpr_t src) {
+    rex(true, dst, src);
+    u8(0x0f);
+    u8(0x40 | condition);
+    modrm(dst, src);
+  }
+  // test al, imm8
+  void test_al(uint8_t value) {
+    u8(0xa8);
+    u8(value);
+  }
+  void call(const void *target) {
+    mov_imm(rax, reinterpret_cast<uint64_t>(target));
+    u8(0xff);
+    modrm(2, rax);
+  }
+  // forward jcc rel8, returns the displacement to patch
+  uint8_t *jump_forward(condition_t condition) {
+    u8(0x70 | condition);
+    u8(0);
+    return cursor - 1;
+  }
+  void patch(uint8_t *displacement) {
+    *displacement = static_cast<uint8_t>(cursor - displacement - 1);
+  }
+
+  void push(gpr_t gpr) {
+    rex(false, 0, gpr);
+    u8(0x50 | (gpr & 7));
+  }
+  void pop(gpr_t gpr) {
+    rex(false, 0, gpr);
+    u8(0x58 | (gpr & 7));
+  }
+  void prologue() {
+    push(rbx);
+    push(r12);
+    push(r13);
+    mov(rbx, rdi);
+    mov(r13, rsi);
+    mov(r12, rdx);
+  }
+  // returns index, pc has to be written back already
+  void leave(uint32_t index) {
+    mov_imm(rax, index);
+    pop(r13);
+    pop(r12);
+    pop(rbx);
+    u8(0xc3);
+  }
+  // writes back pc and returns index
+  void exit(register_t pc, uint32_t index) {
+    mov_imm(rax, pc);
+    store_pc(rax);
+    leave(index);
+  }
+
+  uint8_t *cursor;
+};
+
+// upper bound on the code emitted for one instruction, including its exit
+static const size_t max_native_instruction_size = 96;
+
+// emits one instruction, returns false without emitting anything useful if the
+// instruction is left to the interpreter, terminated is set once the
+// instruction exited the block itself
+inline bool jit_compile_instruction(x86_64_emitter_t            &e,
+                                    const decoded_instruction_t &inst,
+                                    register_t pc, uint32_t index,
+                                    uint32_t size, const jit_helpers_t &helpers,
+                                    bool &terminated) {
+  using gpr_t        = x86_64_emitter_t::gpr_t;
+  using alu_t        = x86_64_emitter_t::alu_t;
+  using shift_t      = x86_64_emitter_t::shift_t;
+  using condition_t  = x86_64_emitter_t::condition_t;
+  const gpr_t rax    = x86_64_emitter_t::rax;
+  const gpr_t rcx    = x86_64_emitter_t::rcx;
+  const gpr_t rdx    = x86_64_emitter_t::rdx;
+  const gpr_t rsi    = x86_64_emitter_t::rsi;
+  const gpr_t rdi    = x86_64_emitter_t::rdi;
+  const gpr_t r12    = x86_64_emitter_t::r12;
+  uint32_t    funct3 = extract_bit_range(inst.instruction, 12, 15);
+  uint32_t    funct7 = extract_bit_range(inst.instruction, 25, 32);
+  int32_t     imm    = static_cast<int32_t>(inst.imm);
+  terminated         = false;
+
+  // rd = rs1 op imm
+  auto alu_imm = [&](alu_t op, bool wide) {
+    if (inst.rd == sink_register) return;
+    e.load_guest(rax, inst.rs1);
+    e.alu_imm(op, wide, rax, imm);
+    if (!wide) e.sign_extend_32(rax, rax);
+    e.store_guest(inst.rd, rax);
+  };
+  // rd = rs1 op rs2
+  auto alu = [&](alu_t op, bool wide) {
+    if (inst.rd == sink_register) return;
+    e.load_guest(rax, inst.rs1);
+    e.load_guest(rcx, inst.rs2);
+    e.alu(op, wide, rax, rcx);
+    if (!wide) e.sign_extend_32(rax, rax);
+    e.store_guest(inst.rd, rax);
+  };
+  auto shift_imm = [&](shift_t op, bool wide) {
+    if (inst.rd == sink_register) return;
+    e.load_guest(rax, inst.rs1);
+    e.shift_imm(op, wide, rax, imm & (wide ? 0b111111 : 0b11111));
+    if (!wide) e.sign_extend_32(rax, rax);
+    e.store_guest(inst.rd, rax);
+  };
+  // x86 masks the shift amount in cl the same way riscv does
+  auto shift = [&](shift_t op, bool wide) {
+    if (inst.rd == sink_register) return;
+    e.load_guest(rax, inst.rs1);
+    e.load_guest(rcx, inst.rs2);
+    e.shift(op, wide, rax);
+    if (!wide) e.sign_extend_32(rax, rax);
+    e.store_guest(inst.rd, rax);
+  };
+  auto mul = [&](bool wide) {
+    if (inst.rd == sink_register) return;
+    e.load_guest(rax, inst.rs1);
+    e.load_guest(rcx, inst.rs2);
+    e.imul(wide, rax, rcx);
+    if (!wide) e.sign_extend_32(rax, rax);
+    e.store_guest(inst.rd, rax);
+  };
+  auto set_imm = [&](condition_t condition) {
+    if (inst.rd == sink_register) return;
+    e.load_guest(rax, inst.rs1);
+    e.alu_imm(x86_64_emitter_t::e_cmp, true, rax, imm);
+    e.set_rax(condition);
+    e.store_guest(inst.rd, rax);
+  };
+  auto set = [&](condition_t condition) {
+    if (inst.rd == sink_register) return;
+    e.load_guest(rax, inst.rs1);
+    e.load_guest(rcx, inst.rs2);
+    e.alu(x86_64_emitter_t::e_cmp, true, rax, rcx);
+    e.set_rax(condition);
+    e.store_guest(inst.rd, rax);
+  };
+  // the helper returning false leaves the block at this instruction
+  auto exit_unless_helper_succeeded = [&]() {
+    e.test_al(1);
+    uint8_t *skip = e.jump_forward(x86_64_emitter_t::e_ne);
+    e.exit(pc, index);
+    e.patch(skip);
+  };
+  auto branch = [&](condition_t condition) {
+    register_t target = pc + inst.imm;
+    if (target % 4 != 0) return false;
+    e.load_guest(rax, inst.rs1);
+    e.load_guest(rcx, inst.rs2);
+    e.alu(x86_64_emitter_t::e_cmp, true, rax, rcx);
+    e.mov_imm(rax, pc + 4);
+    e.mov_imm(rdx, target);
+    e.cmov(condition, rax, rdx);
+    e.store_pc(rax);
+    e.leave(size);
+    return true;
+  };
+
+  switch (extract_bit_range(inst.instruction, 2, 7)) {
+    case 0b01101:  // lui
+      if (inst.rd == sink_register) return true;
+      e.mov_imm(rax, inst.imm);
+      e.store_guest(inst.rd, rax);
+      return true;
+
+    case 0b00101:  // auipc
+      if (inst.rd == sink_register) return true;
+      e.mov_imm(rax, pc + inst.imm);
+      e.store_guest(inst.rd, rax);
+      return true;
+
+    case 0b00100:
+      switch (funct3) {
+        case 0b000:
+          alu_imm(x86_64_emitter_t::e_add, true);
+          return true;
+        case 0b010:
+          set_imm(x86_64_emitter_t::e_l);
+          return true;
+        case 0b011:
+          set_imm(x86_64_emitter_t::e_b);
+          return true;
+        case 0b100:
+          alu_imm(x86_64_emitter_t::e_xor, true);
+          return true;
+        case 0b110:
+          alu_imm(x86_64_emitter_t::e_or, true);
+          return true;
+        case 0b111:
+          alu_imm(x86_64_emitter_t::e_and, true);
+          return true;
+        case 0b001:
+          if (extract_bit_range(inst.instruction, 26, 32) != 0) return false;
+          shift_imm(x86_64_emitter_t::e_shl, true);
+          return true;
+        case 0b101:
+          switch (extract_bit_range(inst.instruction, 26, 32)) {
+            case 0b000000:
+              shift_imm(x86_64_emitter_t::e_shr, true);
+              return true;
+            case 0b010000:
+              shift_imm(x86_64_emitter_t::e_sar, true);
+              return true;
+          }
+          return false;
+      }
+      return false;
+
+    case 0b00110:
+      switch (funct3) {
+        case 0b000:
+          alu_imm(x86_64_emitter_t::e_add, false);
+          return true;
+        case 0b001:
+          if (funct7 != 0) return false;
+          shift_imm(x86_64_emitter_t::e_shl, false);
+          return true;
+        case 0b101:
+          if (funct7 == 0b0000000) {
+            shift_imm(x86_64_emitter_t::e_shr, false);
+            return true;
+          }
+          if (funct7 == 0b0100000) {
+            shift_imm(x86_64_emitter_t::e_sar, false);
+            return true;
+          }
+          return false;
+      }
+      return false;
+
+    case 0b01100:
+      switch (funct7 << 3 | funct3) {
+        case 0b0000000 << 3 | 0b000:
+          alu(x86_64_emitter_t::e_add, true);
+          return true;
+        case 0b0100000 << 3 | 0b000:
+          alu(x86_64_emitter_t::e_sub, true);
+          return true;
+        case 0b0000000 << 3 | 0b001:
+          shift(x86_64_emitter_t::e_shl, true);
+          return true;
+        case 0b0000000 << 3 | 0b010:
+          set(x86_64_emitter_t::e_l);
+          return true;
+        case 0b0000000 << 3 | 0b011:
+          set(x86_64_emitter_t::e_b);
+          return true;
+        case 0b0000000 << 3 | 0b100:
+          alu(x86_64_emitter_t::e_xor, true);
+          return true;
+        case 0b0000000 << 3 | 0b101:
+          shift(x86_64_emitter_t::e_shr, true);
+          return true;
+        case 0b0100000 << 3 | 0b101:
+          shift(x86_64_emitter_t::e_sar, true);
+          return true;
+        case 0b0000000 << 3 | 0b110:
+          alu(x86_64_emitter_t::e_or, true);
+          return true;
+        case 0b0000000 << 3 | 0b111:
+          alu(x86_64_emitter_t::e_and, true);
+          return true;
+        case 0b0000001 << 3 | 0b000:
+          mul(true);
+          return true;
+      }
+      // Note: mulh*, div and rem end the native block and run in the
+      // interpreter
+      return false;
+
+    case 0b01110:
+      switch (funct7 << 3 | funct3) {
+        case 0b0000000 << 3 | 0b000:
+          alu(x86_64_emitter_t::e_add, false);
+          return true;
+        case 0b0100000 << 3 | 0b000:
+          alu(x86_64_emitter_t::e_sub, false);
+          return true;
+        case 0b0000000 << 3 | 0b001:
+          shift(x86_64_emitter_t::e_shl, false);
+          return true;
+        case 0b0000000 << 3 | 0b101:
+          shift(x86_64_emitter_t::e_shr, false);
+          return true;
+        case 0b0100000 << 3 | 0b101:
+          shift(x86_64_emitter_t::e_sar, false);
+          return true;
+        case 0b0000001 << 3 | 0b000:
+          mul(false);
+          return true;
+      }
+      return false;
+
+    case 0b00000:  // load
+      if (!helpers.load[funct3]) return false;
+      e.mov(rdi, r12);
+      e.load_guest(rsi, inst.rs1);
+      e.alu_imm(x86_64_emitter_t::e_add, true, rsi, imm);
+      // Note: a load to x0 still has to happen, it can fault or hit mmio
+      e.address_guest(rdx, inst.rd);
+      e.call(reinterpret_cast<const void *>(helpers.load[funct3]));
+      exit_unless_helper_succeeded();
+      return true;
+
+    case 0b00011:  // fence, nothing to order on a single hart
+      return funct3 == 0b000;
+
+    case 0b01000:  // store
+      if (!helpers.store[funct3]) return false;
+      e.mov(rdi, r12);
+      e.load_guest(rsi, inst.rs1);
+      e.alu_imm(x86_64_emitter_t::e_add, true, rsi, imm);
+      e.load_guest(rdx, inst.rs2);
+      e.call(reinterpret_cast<const void *>(helpers.store[funct3]));
+      exit_unless_helper_succeeded();
+      return true;
+
+    case 0b11000:  // branch
+      terminated = true;
+      switch (funct3) {
+        case 0b000:
+          return branch(x86_64_emitter_t::e_e);
+        case 0b001:
+          return branch(x86_64_emitter_t::e_ne);
+        case 0b100:
+          return branch(x86_64_emitter_t::e_l);
+        case 0b101:
+          return branch(x86_64_emitter_t::e_ge);
+        case 0b110:
+          return branch(x86_64_emitter_t::e_b);
+        case 0b111:
+          return branch(x86_64_emitter_t::e_ae);
+      }
+      return false;
+
+    case 0b11011: {  // jal
+      register_t target = pc + inst.imm;
+      if (target % 4 != 0) return false;
+      if (inst.rd != sink_register) {
+        e.mov_imm(rax, pc + 4);
+        e.store_guest(inst.rd, rax);
+      }
+      terminated = true;
+      e.exit(target, size);
+      return true;
+    }
+
+    case 0b11001: {  // jalr
+      if (funct3 != 0) return false;
+      e.load_guest(rax, inst.rs1);
+      e.alu_imm(x86_64_emitter_t::e_add, true, rax, imm);
+      e.alu_imm(x86_64_emitter_t::e_and, true, rax, ~1);
+      // misaligned targets trap in the interpreter
+      e.test_al(0b11);
+      uint8_t *aligned = e.jump_forward(x86_64_emitter_t::e_e);
+      e.exit(pc, index);
+      e.patch(aligned);
+      if (inst.rd != sink_register) {
+        e.mov_imm(rcx, pc + 4);
+        e.store_guest(inst.rd, rcx);
+      }
+      e.store_pc(rax);
+      e.leave(size);
+      terminated = true;
+      return true;
+    }
+  }
+  return false;
+}
+
+// compiles as much of a block as possible starting from its first instruction,
+// returns nullptr if not even the first instruction could be compiled
+// Note: the cache needs (size + 1) * max_native_instruction_size bytes free,
+// and the native code relies on reg[0] being 0 when it is entered
+inline native_block_t jit_compile_block(
+    code_cache_t &cache, register_t pc,
+    const decoded_instruction_t *instructions, uint32_t size,
+    const jit_helpers_t &helpers) {
+  x86_64_emitter_t e;
+  e.cursor            = cache.base + cache.used;
+  uint8_t *entry      = e.cursor;
+  bool     terminated = false;
+  uint32_t index      = 0;
+  e.prologue();
+  for (; index < size && !terminated; index++) {
+    uint8_t *start = e.cursor;
+    if (!jit_compile_instruction(e, instructions[index], pc + index * 4,
+                                 index, size, helpers, terminated)) {
+      e.cursor   = start;
+      terminated = false;
+      break;
+    }
+  }
+  if (index == 0) return nullptr;
+  if (!terminated) e.exit(pc + index * 4, index);
+  cache.used += e.cursor - entry;
+  return reinterpret_cast<native_block_t>(entry);
+}
+#endif
+
+// what a machine_t is compiled for
+enum class machine_profile_t : uint8_t {
+  // machine and user mode, csrs, interrupts and wfi, traps go to mtvec unless
+  // there is a trap callback
+  e_system,
+  // user mode scripts, every trap goes to the trap callback, ecall included,
+  // and nothing polls for interrupts
+  e_application,
+};
+
+// instructions that need machine mode state, the application profile raises
+// illegal instruction for them so the host can decide what to do
+constexpr instruction_id_t privileged_instructions[] = {
+    e_mret,  e_wfi,    e_csrrw,  e_csrrs,
+    e_csrrc, e_csrrwi, e_csrrsi, e_csrrci,
+};
+
+// why run returned
+enum class run_exit_t : uint8_t {
+  e_budget,       // the instruction budget is used up
+  e_wfi,          // the hart is waiting for an interrupt
+  e_exit,         // request_exit was called, for example from a trap callback
+  e_watchpoint,   // the next instruction is at a watchpoint
+  e_out_of_fuel,  // _fuel is used up
+  e_preempted,    // preempt was called or the run_for time slice ran out
+};
+
+// bits of machine_t::_attention, the only state the interpreter polls, it is
+// tested once per block (once per instruction without the instruction cache)
+// and everything else happens on the slow path taken when a bit is set
+enum attention_t : uint8_t {
+  e_attention_exit       = 1 << 0,  // request_exit
+  e_attention_preempt    = 1 << 1,  // preempt, run_for
+  e_attention_interrupt  = 1 << 2,  // mip, mie or mstatus changed
+  e_attention_wfi        = 1 << 3,  // the hart executed wfi
+  e_attention_watchpoint = 1 << 4,  // set as long as there are watchpoints
+};
+
+// sets a bit in an attention word once a deadline passes, its thread is only
+// started by the first arm
+struct preemption_timer_t {
+  ~preemption_timer_t() {
+    if (!thread.joinable()) return;
+    {
+      std::lock_guard lock{mutex};
+      stop = true;
+    }
+    condition.notify_one();
+    thread.join();
+  }
+
+  void arm(std::atomic<uint8_t> *attention, uint8_t bit,
+           std::chrono::steady_clock::time_point deadline) {
+    std::lock_guard lock{mutex};
+    if (!thread.joinable()) thread = std::thread{[this]() { worker(); }};
+    this->attention = attention;
+    this->bit       = bit;
+    this->deadline  = deadline;
+    armed           = true;
+    condition.notify_one();
+  }
+  // Note: once disarm returns the bit is not set anymore by this timer
+  void disarm() {
+    std::lock_guard lock{mutex};
+    armed = false;
+  }
+
+  void worker() {
+    std::unique_lock lock{mutex};
+    while (!stop) {
+      if (!armed) {
+        condition.wait(lock);
+      } else if (std::chrono::steady_clock::now() >= deadline) {
+        attention->fetch_or(bit, std::memory_order::relaxed);
+        armed = false;
+      } else {
+        condition.wait_until(lock, deadline);
+      }
+    }
+  }
+
+  std::thread                           thread;
+  std::mutex                            mutex;
+  std::condition_variable               condition;
+  std::atomic<uint8_t>                 *attention = nullptr;
+  uint8_t                               bit       = 0;
+  std::chrono::steady_clock::time_point deadline;
+  bool                                  armed = false;
+  bool                                  stop  = false;
+};
+
+struct run_result_t {
+  run_exit_t reason;
+  // Note: an instruction that traps counts as retired
+  uint64_t   retired;
+};
+
+// TODO: accurate runtime memory bounds checking (account for size of
+// load/store)
+// the tlbs for loads, stores and fetches hold tlb_size pages each, in sets of
+// tlb_ways
+// the block cache holds block_cache_ways blocks in each of its
+// 1 << bits_per_block_cache sets, it is only used with DAWN_INSTRUCTION_CACHE
+template <size_t tlb_size, size_t bits_per_page,
+          size_t            tlb_ways             = 4,
+          size_t            bits_per_block_cache = 10,
+          size_t            block_cache_ways     = 1,
+          machine_profile_t profile              = machine_profile_t::e_system>
+struct machine_t {
+  static_assert(block_cache_ways >= 1, "the block cache needs a way per set");
+  static constexpr bool _is_application =
+      profile == machine_profile_t::e_application;
+
+  machine_t(size_t ram_size, const std::vector<mmio_handler_t> mmios,
+            void *user_state, uint8_t *(*allocate_callback)(void *, uint64_t),
+            void (*deallocate_callback)(void *, uint8_t *),
+            page_metadata_t default_page_metadata)
+      : _memory(ram_size, user_state, allocate_callback, deallocate_callback,
+                default_page_metadata),
+        _mmios(mmios) {
+    for (const auto &mmio : mmios) {
+      register_t start = _memory.page_number(mmio.start);
+      register_t stop  = _memory.page_number(mmio.stop - 1);
+
+      page_t page;
+      for (; start <= stop; start++) {
+        page_t *entry = _memory.page_table.find(start);
+        if (!entry) {
+          page.descriptor                  = start | page_metadata_t::e_rwm;
+          mmio_page_data_t &mmio_page_data = _mmio_page_data.emplace_back();
+          page.ptr                         = &mmio_page_data;
+          _memory.page_table[start]        = page;
+        } else {
+          page = *entry;
+        }
+        mmio_page_data_t &mmio_page_data =
+            *reinterpret_cast<mmio_page_data_t *>(page.ptr);
+        mmio_page_data.mmios.push_back(mmio);
+      }
+    }
+#if defined(DAWN_INSTRUCTION_CACHE) || defined(DAWN_PREDECODE)
+    _memory.code_write_state    = this;
+    _memory.code_write_callback = [](void *machine, register_t page_number) {
+      reinterpret_cast<machine_t *>(machine)->invalidate_code(page_number);
+    };
+#endif
+  }
+  ~machine_t() {}
+
+  // TODO: a more involved csr read
+  inline register_t read_csr(uint16_t csrno, std::memory_order memory_order =
+                                                 std::memory_order::relaxed) {
+    return _csr[csrno].load(memory_order);
+  }
+  // TODO: a more involved csr write
+  inline void write_csr(
+      uint16_t csrno, register_t value,
+      std::memory_order memory_order = std::memory_order_relaxed) {
+    _csr[csrno].store(value, memory_order);
+    if (_is_application) return;
+    if (csrno == MIP || csrno == MIE || csrno == MSTATUS) [[unlikely]]
+      _attention.fetch_or(e_attention_interrupt, std::memory_order::release);
+  }
+  // TODO: a more involved csr fetch or
+  inline void fetch_or_csr(
+      uint16_t csrno, register_t value,
+      std::memory_order memory_order = std::memory_order::relaxed) {
+    register_t current = _csr[csrno].load(std::memory_order::relaxed);
+    if ((current & value) != value) {
+      _csr[csrno].fetch_or(value, memory_order);
+      // Note: only setting bits can make an interrupt pending
+      if (!_is_application &&
+          (csrno == MIP || csrno == MIE || csrno == MSTATUS))
+        _attention.fetch_or(e_attention_interrupt, std::memory_order::release);
+    }
+  }
+  // TODO: a more involved csr fetch and
+  inline void fetch_and_csr(
+      uint16_t csrno, register_t value,
+      std::memory_order memory_order = std::memory_order::relaxed) {
+    register_t current = _csr[csrno].load(std::memory_order::relaxed);
+    if ((current & ~value) != 0) _csr[csrno].fetch_and(value, memory_order);
+  }
+
+  inline bool memcpy_host_to_guest(register_t dst_addr, const void *src_ptr,
+                                   size_t size) {
+    register_t     remaining    = size;
+    register_t     current_addr = dst_addr;
+    const uint8_t *src          = reinterpret_cast<const uint8_t *>(src_ptr);
+    while (remaining > 0) {
+      page_t page;
+      __get_page(_memory, page_metadata_t::e_mask, current_addr, page);
+      if (!page.ptr) return false;
+      if (page.has_metadata(page_metadata_t::e_m))
+        throw std::runtime_error("cannot memcpy_host_to_guest mmio");
+      register_t offset     = _memory.page_offset(current_addr);
+      register_t chunk_size = _memory.bytes_per_page - offset;
       if (chunk_size > remaining) chunk_size = remaining;
       std::memcpy(static_cast<uint8_t *>(page.ptr) + offset,
                   src + (size - remaining), chunk_size);
+#if defined(DAWN_INSTRUCTION_CACHE) || defined(DAWN_PREDECODE)
+      if (page.has_metadata(page_metadata_t::e_c))
+        invalidate_code(_memory.page_number(current_addr));
+#endif
       current_addr += chunk_size;
       remaining -= chunk_size;
     }
@@ -973,6 +2609,10 @@ struct machine_t {
       register_t chunk_size = _memory.bytes_per_page - offset;
       if (chunk_size > remaining) chunk_size = remaining;
       std::memset(static_cast<uint8_t *>(page.ptr) + offset, value, chunk_size);
+#if defined(DAWN_INSTRUCTION_CACHE) || defined(DAWN_PREDECODE)
+      if (page.has_metadata(page_metadata_t::e_c))
+        invalidate_code(_memory.page_number(current_addr));
+#endif
       current_addr += chunk_size;
       remaining -= chunk_size;
     }
@@ -987,18 +2627,17 @@ struct machine_t {
     const uint8_t *src          = reinterpret_cast<const uint8_t *>(src_ptr);
     while (remaining > 0) {
       register_t page_number = _memory.page_number(current_addr);
-      auto       itr         = _memory.page_table.find(page_number);
+      page_t    *entry       = _memory.page_table.find(page_number);
       page_t     page;
-      if (itr == _memory.page_table.end()) {
+      if (!entry) {
         page_t new_page = _memory.allocate_page(page_number, metadata);
         if (!new_page.ptr) return false;
         _memory.page_table[page_number] = new_page;
         page                            = new_page;
       } else {
-        itr->second.descriptor =
-            itr->second.descriptor & ~page_metadata_t::e_mask;
-        itr->second.descriptor = itr->second.descriptor | metadata;
-        page                   = itr->second;
+        entry->descriptor = entry->descriptor & ~page_metadata_t::e_mask;
+        entry->descriptor = entry->descriptor | metadata;
+        page              = *entry;
       }
       assert(page.ptr);
       register_t offset     = _memory.page_offset(current_addr);
@@ -1006,10 +2645,16 @@ struct machine_t {
       if (chunk_size > remaining) chunk_size = remaining;
       std::memcpy(static_cast<uint8_t *>(page.ptr) + offset,
                   src + (size - remaining), chunk_size);
+      _memory.invalidate_page(page_number);
+#if defined(DAWN_INSTRUCTION_CACHE) || defined(DAWN_PREDECODE)
+      invalidate_code(page_number);
+#endif
       current_addr += chunk_size;
       remaining -= chunk_size;
     }
-    _memory.invalidate_caches();
+#ifdef DAWN_PREDECODE
+    if (metadata & page_metadata_t::e_x) predecode(dst_addr, size);
+#endif
     return true;
   }
   inline bool set_memory(register_t dst_addr, int value, uint64_t size,
@@ -1020,34 +2665,46 @@ struct machine_t {
     register_t current_addr = dst_addr;
     while (remaining > 0) {
       register_t page_number = _memory.page_number(current_addr);
-      auto       itr         = _memory.page_table.find(page_number);
+      page_t    *entry       = _memory.page_table.find(page_number);
       page_t     page;
-      if (itr == _memory.page_table.end()) {
+      if (!entry) {
         page_t new_page = _memory.allocate_page(page_number, metadata);
         if (!new_page.ptr) return false;
         _memory.page_table[page_number] = new_page;
         page                            = new_page;
       } else {
-        itr->second.descriptor =
-            itr->second.descriptor & ~page_metadata_t::e_mask;
-        itr->second.descriptor = itr->second.descriptor | metadata;
-        page                   = itr->second;
+        entry->descriptor = entry->descriptor & ~page_metadata_t::e_mask;
+        entry->descriptor = entry->descriptor | metadata;
+        page              = *entry;
       }
       assert(page.ptr);
       register_t offset     = _memory.page_offset(current_addr);
       register_t chunk_size = _memory.bytes_per_page - offset;
       if (chunk_size > remaining) chunk_size = remaining;
       std::memset(static_cast<uint8_t *>(page.ptr) + offset, value, chunk_size);
+      _memory.invalidate_page(page_number);
+#if defined(DAWN_INSTRUCTION_CACHE) || defined(DAWN_PREDECODE)
+      invalidate_code(page_number);
+#endif
       current_addr += chunk_size;
       remaining -= chunk_size;
     }
-    _memory.invalidate_caches();
     return true;
   }
 
   // TODO: test with and without inline
   // TODO: test with a macro
   inline bool handle_trap(exception_code_t cause, register_t value) {
+    if constexpr (_is_application) {
+      if (!_trap_callback) [[unlikely]] {
+        std::stringstream ss;
+        ss << "Error: " << cause << " without a trap callback\n";
+        ss << "at: " << std::hex << _pc << std::dec << '\n';
+        throw std::runtime_error(ss.str());
+      }
+      _trap_callback(_trap_usr_data, cause, value);
+      return true;
+    }
     // Note: all traps clears wfi
     _wfi.store(false, std::memory_order::relaxed);
     // hack
@@ -1102,1570 +2759,3368 @@ struct machine_t {
   }
 
   std::optional<uint8_t> at(register_t addr) {
-    exception_code_t trap_cause;
-    register_t       trap_value;
-    uint8_t          value;
+#ifdef DAWN_SANDBOX
+    // Note: host code stays out of the guest view, its faults are only caught
+    // while the guest runs
+    auto [loaded, byte] = load_slow<uint8_t>(_memory, addr);
+    if (loaded) return byte;
+    return std::nullopt;
+#else
+    [[maybe_unused]] exception_code_t trap_cause;
+    [[maybe_unused]] register_t       trap_value;
+    uint8_t                           value;
     __load8(_memory, value, addr);
     return value;
   _do_trap:
     return std::nullopt;
+#endif
   }
 
   bool insert_page(register_t page_number, uint8_t *ptr,
                    page_metadata_t metadata) {
+#ifdef DAWN_FLAT_RAM
+    if (_memory.ram_page(page_number))
+      throw std::runtime_error("cannot insert a page into the ram window");
+#endif
     page_t new_page = _memory.create_page(page_number, ptr, metadata);
     _memory.page_table[page_number] = new_page;
-    if (_memory.mru_page.number() == page_number) {
-      _memory.mru_page = new_page;
-    }
-    if (_memory.fetch_mru_page.number() == page_number) {
-      _memory.fetch_mru_page = new_page;
-    }
-    register_t cache_index = _memory.cache_index(page_number);
-    if (_memory.direct_cache[cache_index].number() == page_number) {
-      _memory.direct_cache[cache_index] = new_page;
-    }
-    if (_memory.fetch_direct_cache[cache_index].number() == page_number) {
-      _memory.fetch_direct_cache[cache_index] = new_page;
-    }
+    _memory.invalidate_page(page_number);
+#if defined(DAWN_INSTRUCTION_CACHE) || defined(DAWN_PREDECODE)
+    invalidate_code(page_number);
+#endif
     return true;
   }
 
+#ifdef DAWN_FLAT_RAM
+  // makes [base, base + size) plain rwx ram in a single host mapping, loads,
+  // stores and fetches in it are a bounds check and an add, mmio and memory
+  // outside of it keep using pages
+  // Note: has to come before anything is mapped in the range
+  bool map_ram(register_t base, register_t size, bool huge_pages = false) {
+    register_t first = _memory.page_number(base);
+    for (register_t i = 0; i < _memory.page_number(size); i++) {
+      if (_memory.page_table.contains(first + i)) return false;
+    }
+    return _memory.map_ram(base, size, huge_pages);
+  }
+#endif
+
   bool insert_new_page(register_t page_number, page_metadata_t metadata) {
     page_t new_page = _memory.allocate_page(page_number, metadata);
     _memory.page_table[page_number] = new_page;
-    if (_memory.mru_page.number() == page_number) {
-      _memory.mru_page = new_page;
-    }
-    if (_memory.fetch_mru_page.number() == page_number) {
-      _memory.fetch_mru_page = new_page;
-    }
-    register_t cache_index = _memory.cache_index(page_number);
-    if (_memory.direct_cache[cache_index].number() == page_number) {
-      _memory.direct_cache[cache_index] = new_page;
+    _memory.invalidate_page(page_number);
+#if defined(DAWN_INSTRUCTION_CACHE) || defined(DAWN_PREDECODE)
+    invalidate_code(page_number);
+#endif
+    return true;
+  }
+
+#if defined(DAWN_INSTRUCTION_CACHE) || defined(DAWN_PREDECODE)
+  // sets or clears e_c of a page, the cached copies of its descriptor are
+  // dropped so the store fast path sees the change
+  inline void mark_code_page(register_t page_number, bool code) {
+    page_t *entry = _memory.page_table.find(page_number);
+#ifdef DAWN_FLAT_RAM
+    // Note: the window is used without entries, a page of code needs one for
+    // its stores to reach the slow path
+    if (!entry && code && _memory.ram_page(page_number)) {
+      _memory.page_table[page_number] =
+          _memory.allocate_page(page_number, page_metadata_t::e_rwx);
+      entry = _memory.page_table.find(page_number);
     }
-    if (_memory.fetch_direct_cache[cache_index].number() == page_number) {
-      _memory.fetch_direct_cache[cache_index] = new_page;
+    _memory.mark_ram_code(page_number, entry && code);
+#endif
+    if (!entry) return;
+    if (entry->has_metadata(page_metadata_t::e_c) == code) return;
+    if (code)
+      entry->descriptor |= page_metadata_t::e_c;
+    else
+      entry->descriptor &= ~page_metadata_t::e_c;
+    _memory.invalidate_page(page_number);
+  }
+
+#endif
+
+#ifdef DAWN_PREDECODE
+  // executable memory is decoded when it is inserted, the instruction at pc is
+  // _predecoded[(pc - _predecoded_base) / 4] while pc is inside the span, so
+  // dispatch needs neither a tag check nor a page lookup
+  // Note: the labels point into the dispatch table of the engine, which the
+  // computed goto engine only has once it ran, until then the span is sized
+  // and its pages are marked but nothing is decoded, see bind_predecoded
+
+  // grows the span to cover an executable range, the span is decoded again if
+  // it changed
+  inline void predecode(register_t addr, register_t size) {
+    if (size == 0) return;
+    register_t begin    = addr & ~register_t(3);
+    register_t end      = (addr + size + 3) & ~register_t(3);
+    register_t span_end = _predecoded_base + _predecoded_count * 4;
+    if (_predecoded_count) {
+      if (begin >= _predecoded_base && end <= span_end) return;
+      begin = std::min(begin, _predecoded_base);
+      end   = std::max(end, span_end);
     }
-    return true;
+    // Note: a span over segments far apart is not worth the memory, code
+    // outside of the span is fetched as usual
+    if ((end - begin) / 4 > _max_predecoded_instructions) return;
+    _predecoded_base  = begin;
+    _predecoded_count = (end - begin) / 4;
+    _predecoded.assign(_predecoded_count, decoded_instruction_t{});
+    for (register_t page_number = _memory.page_number(begin);
+         page_number <= _memory.page_number(end - 1); page_number++)
+      predecode_page(page_number);
   }
 
-  struct cached_instruction_t {
-    void    *label;
-    uint32_t instruction;
-    uint32_t tag_number;  // Note: should be 64 - 12 = 48 bits, but shouldnt be
-                          // a problem ?
-  };
+  // decodes the words of the span on a page, words on a page that is not
+  // executable go to the miss handler, which fetches them and faults
+  inline void predecode_page(register_t page_number) {
+    register_t page_begin = page_number << _memory.bits_per_page;
+    register_t page_end   = page_begin + _memory.bytes_per_page;
+    register_t span_end   = _predecoded_base + _predecoded_count * 4;
+    if (page_end <= _predecoded_base || page_begin >= span_end) return;
+    register_t first = page_begin > _predecoded_base
+                           ? (page_begin - _predecoded_base) / 4
+                           : 0;
+    register_t last  = page_end < span_end
+                           ? (page_end - _predecoded_base) / 4
+                           : _predecoded_count;
+    page_t *entry      = _memory.page_table.find(page_number);
+    bool    executable = entry && entry->has_metadata(page_metadata_t::e_x) &&
+                         !entry->has_metadata(page_metadata_t::e_m);
+    // Note: stores to the page decode it again
+    if (executable) mark_code_page(page_number, true);
+    if (!_predecoded_table) return;
+    for (register_t i = first; i < last; i++) {
+      decoded_instruction_t &decoded = _predecoded[i];
+      if (!executable) {
+        decoded       = decoded_instruction_t{};
+        decoded.label = _predecoded_miss;
+        continue;
+      }
+      register_t addr = _predecoded_base + i * 4;
+      uint32_t   instruction;
+      std::memcpy(&instruction,
+                  static_cast<const uint8_t *>(entry->ptr) +
+                      _memory.page_offset(addr),
+                  sizeof(instruction));
+      decoded = decode_instruction(instruction, _predecoded_table);
+    }
+  }
 
-  // TODO: all register accesses need to be converted into register_t
-  inline uint64_t step(uint64_t n) {
-    static void *dispatch_table[256] = {nullptr};
+  // points the span at the handlers of an engine, called when a run starts on
+  // a span that was decoded for another one or not at all
+  inline void bind_predecoded(void *const *dispatch_table, void *miss) {
+    _predecoded_table = dispatch_table;
+    _predecoded_miss  = miss;
+    if (!_predecoded_count) return;
+    for (register_t page_number = _memory.page_number(_predecoded_base);
+         page_number <=
+         _memory.page_number(_predecoded_base + _predecoded_count * 4 - 1);
+         page_number++)
+      predecode_page(page_number);
+  }
 
-    // initialize
-    static bool initialized = false;
-    if (!initialized) [[unlikely]] {
-      initialized = true;
-      for (auto &entry : dispatch_table) entry = &&_do_unknown_instruction;
+  // decodes a page again after its contents or its permissions changed
+  inline void invalidate_code(register_t page_number) {
+    predecode_page(page_number);
+  }
+#endif
 
-#define register_range(op, label)                                             \
-  do {                                                                        \
-    for (uint32_t i = 0; i < 8; i++) dispatch_table[op | (i << 5)] = &&label; \
-  } while (false)
-#define register_instr(op, func3, label)       \
-  do {                                         \
-    dispatch_table[op | func3 << 5] = &&label; \
-  } while (false)
+#ifdef DAWN_INSTRUCTION_CACHE
+  // how a block ends, picks where next_block looks for the next one
+  enum class block_exit_t : uint8_t {
+    e_direct,    // branch, jal or straight line, at most two successors
+    e_call,      // jal or jalr that links ra or t0
+    e_return,    // jalr to ra or t0 that does not link
+    e_indirect,  // any other jalr
+  };
 
-      register_range(0b01101, _do_lui);
-      register_range(0b00101, _do_auipc);
-      register_range(0b11011, _do_jal);
-      register_range(0b11001, _do_jalr);
-      register_instr(0b11000, 0b000, _do_beq);
-      register_instr(0b11000, 0b001, _do_bne);
-      register_instr(0b11000, 0b100, _do_blt);
-      register_instr(0b11000, 0b101, _do_bge);
-      register_instr(0b11000, 0b110, _do_bltu);
-      register_instr(0b11000, 0b111, _do_bgeu);
-      register_instr(0b00000, 0b000, _do_lb);
-      register_instr(0b00000, 0b001, _do_lh);
-      register_instr(0b00000, 0b010, _do_lw);
-      register_instr(0b00000, 0b100, _do_lbu);
-      register_instr(0b00000, 0b101, _do_lhu);
-      register_instr(0b01000, 0b000, _do_sb);
-      register_instr(0b01000, 0b001, _do_sh);
-      register_instr(0b01000, 0b010, _do_sw);
-      register_instr(0b00100, 0b000, _do_addi);
-      register_instr(0b00100, 0b010, _do_slti);
-      register_instr(0b00100, 0b011, _do_sltiu);
-      register_instr(0b00100, 0b100, _do_xori);
-      register_instr(0b00100, 0b110, _do_ori);
-      register_instr(0b00100, 0b111, _do_andi);
-#ifdef DAWN_RISCV64
-      register_instr(0b00000, 0b110, _do_lwu);
-      register_instr(0b00000, 0b011, _do_ld);
-      register_instr(0b01000, 0b011, _do_sd);
+  // a run of straight line instructions, it ends at the first control flow or
+  // system instruction, at a page boundary or after _max_block_instructions
+  struct block_t {
+    register_t             pc           = invalid_block_pc;
+    uint32_t               generation   = 0;  // valid while _block_generation
+    uint32_t               size         = 0;
+    decoded_instruction_t *instructions = nullptr;
+    block_exit_t           exit         = block_exit_t::e_direct;
+    // blocks run after this one, only followed while their pc and generation
+    // match: the last two successors, for a call links[1] is the block the
+    // call returns to
+    block_t *links[2] = {};
+#ifdef DAWN_JIT
+    // hotness, the block is promoted to native code once executions reaches
+    // _jit_threshold, promoted is also set if compiling it failed
+    native_block_t native     = nullptr;
+    uint32_t       executions = 0;
+    bool           promoted   = false;
 #endif
-      register_instr(0b00100, 0b001, _do_slli);
-      register_instr(0b00100, 0b101, _do_srli_or_srai);
-#ifdef DAWN_RISCV64
-      register_instr(0b00110, 0b000, _do_addiw);
-      register_instr(0b00110, 0b001, _do_slliw);
-      register_instr(0b00110, 0b101, _do_srliw_or_sraiw);
-      register_instr(0b01110, 0b000, _do_addw_or_subw_or_mulw);
-      register_instr(0b01110, 0b001, _do_sllw);
-      register_instr(0b01110, 0b100, _do_divw);
-      register_instr(0b01110, 0b101, _do_srlw_or_sraw_or_divuw);
-      register_instr(0b01110, 0b110, _do_remw);
-      register_instr(0b01110, 0b111, _do_remuw);
-#endif
-      register_instr(0b01100, 0b000, _do_add_or_sub_or_mul);
-      register_instr(0b01100, 0b001, _do_sll_or_mulh);
-      register_instr(0b01100, 0b010, _do_slt_or_mulhsu);
-      register_instr(0b01100, 0b011, _do_sltu_or_mulhu);
-      register_instr(0b01100, 0b100, _do_xor_or_div);
-      register_instr(0b01100, 0b101, _do_srl_or_sra_or_divu);
-      register_instr(0b01100, 0b110, _do_or_or_rem);
-      register_instr(0b01100, 0b111, _do_and_or_remu);
-      register_instr(0b00011, 0b000, _do_fence);
-      register_instr(0b00011, 0b001, _do_fence);
-      register_instr(0b11100, 0b000, _do_system);  // ecall ebreak mret wfi
-      register_instr(0b11100, 0b001, _do_csrrw);
-      register_instr(0b11100, 0b010, _do_csrrs);
-      register_instr(0b11100, 0b011, _do_csrrc);
-      register_instr(0b11100, 0b101, _do_csrrwi);
-      register_instr(0b11100, 0b110, _do_csrrsi);
-      register_instr(0b11100, 0b111, _do_csrrci);
-      register_instr(0b01011, 0b010, _do_atomic_w);
-#ifdef DAWN_RISCV64
-      register_instr(0b01011, 0b011, _do_atomic_d);
+#ifdef DAWN_AOT
+    aot_region_fn_t aot = nullptr;  // set if a loaded module translated pc
 #endif
-    }
+  };
 
-    uint32_t      _inst;
-    instruction_t inst;
+  // lookups since the last reset_block_cache_stats, a lookup per block run
+  struct block_cache_stats_t {
+    uint64_t hits          = 0;
+    uint64_t misses        = 0;
+    uint64_t invalidations = 0;  // whole cache flushes
+    uint64_t chained       = 0;  // next blocks found without a lookup
+  };
 
-    // f f f o o o o o (f is func3, o is op)
-    // Note: we ignore the first 2 bits of op since we dont implement compressed
-    // instructions
+  inline block_cache_stats_t block_cache_stats() const {
+    return _block_cache_stats;
+  }
+  inline void reset_block_cache_stats() { _block_cache_stats = {}; }
 
-#ifdef DAWN_INSTRUCTION_CACHE
-    constexpr uint64_t cached_instruction_mask = (1ull << 32) - 1;
-#define dispatch()                                                           \
-  do {                                                                       \
-    if (_wfi.load(std::memory_order::relaxed)) [[unlikely]]                  \
-      return n;                                                              \
-    _reg[0] = 0;                                                             \
-    if (n-- == 0) [[unlikely]]                                               \
-      return 0;                                                              \
-    uint32_t cached_instruction_index =                                      \
-        (_pc >> 2) & (_num_instruction_cache - 1);                           \
-    if (_cached_instructions[cached_instruction_index].tag_number ==         \
-        ((_pc >> _bits_per_instruction_cache) & cached_instruction_mask))    \
-        [[likely]] {                                                         \
-      _inst = _cached_instructions[cached_instruction_index].instruction;    \
-      reinterpret_cast<uint32_t &>(inst) = _inst;                            \
-      goto *_cached_instructions[cached_instruction_index].label;            \
-    } else {                                                                 \
-      __fetch32(_memory, _inst, _pc);                                        \
-      const uint32_t dispatch_index = extract_bit_range(_inst, 2, 7) |       \
-                                      extract_bit_range(_inst, 12, 15) << 5; \
-      _cached_instructions[cached_instruction_index].instruction = _inst;    \
-      _cached_instructions[cached_instruction_index].label =                 \
-          dispatch_table[dispatch_index];                                    \
-      _cached_instructions[cached_instruction_index].tag_number =            \
-          (_pc >> _bits_per_instruction_cache) & cached_instruction_mask;    \
-      reinterpret_cast<uint32_t &>(inst) = _inst;                            \
-      goto *_cached_instructions[cached_instruction_index].label;            \
-    }                                                                        \
-  } while (false)
-#else
-#define dispatch()                                                         \
-  do {                                                                     \
-    if (_wfi.load(std::memory_order::relaxed)) [[unlikely]]                \
-      return n;                                                            \
-    _reg[0] = 0;                                                           \
-    if (n-- == 0) [[unlikely]]                                             \
-      return 0;                                                            \
-    __fetch32(_memory, _inst, _pc);                                        \
-    const uint32_t dispatch_index = extract_bit_range(_inst, 2, 7) |       \
-                                    extract_bit_range(_inst, 12, 15) << 5; \
-    reinterpret_cast<uint32_t &>(inst) = _inst;                            \
-    goto *dispatch_table[dispatch_index];                                  \
-  } while (false)
-#endif
+  constexpr register_t block_set(register_t pc) const {
+    return (pc >> 2) & (_num_block_sets - 1);
+  }
 
-#ifdef DAWN_ENABLE_LOGGING
-    auto logger = [&]() {
-      _log << "pc: " << std::hex << _pc;
-      for (uint32_t i = 0; i < 32; i++) {
-        if (_reg[i] != 0) {
-          _log << "    x" << std::dec << i << ": " << std::hex << _reg[i];
-        }
+  // returns the block starting at pc, nullptr if it is not cached
+  inline block_t *lookup_block(register_t pc) {
+    block_t *set = &_blocks[block_set(pc) * block_cache_ways];
+    for (size_t way = 0; way < block_cache_ways; way++) {
+      if (set[way].pc == pc && set[way].generation == _block_generation)
+          [[likely]] {
+        _block_cache_stats.hits++;
+        return &set[way];
       }
-      _log << '\n';
-      _log.flush();
-    };
-
-#define do_dispatch() \
-  do {                \
-    dispatch();       \
-  } while (false)
-#else
-#define do_dispatch() dispatch()
-#endif
+    }
+    _block_cache_stats.misses++;
+    return nullptr;
+  }
 
-    exception_code_t trap_cause;
-    register_t       trap_value;
+  constexpr bool is_linked(const block_t *link, register_t pc) const {
+    return link && link->pc == pc && link->generation == _block_generation;
+  }
 
-    // check for interrupts after every instruction that can potentially
-    // enable/disable interrupts, ie mret csr accessing instructions
-  _check_for_interrupts:
-    // check pending interrupts
-    // Note: only mip needs acquire since only this csr can be written to
-    // outside of machine
-    register_t pending_interrupts =
-        read_csr(MIP, std::memory_order::acquire) & read_csr(MIE);
-    if (pending_interrupts) {
-      _wfi.store(false, std::memory_order::relaxed);
-      if ((_mode & 0b11) < 0b11 || read_csr(MSTATUS) & MSTATUS_MIE_MASK) {
-        if (pending_interrupts & MIP_MEIP_MASK) {
-          do_trap(exception_code_t::e_machine_external_interrupt, 0);
-        } else if (pending_interrupts & MIP_MSIP_MASK) {
-          do_trap(exception_code_t::e_machine_software_interrupt, 0);
-        } else if (pending_interrupts & MIP_MTIP_MASK) {
-          do_trap(exception_code_t::e_machine_timer_interrupt, 0);
+  // the block to run at pc after _last_block, found through the links of the
+  // last block or the return address stack before falling back to the block
+  // cache, translated if it is not cached, nullptr if pc cannot be fetched
+  inline block_t *next_block(register_t pc, void *const *dispatch_table) {
+    block_t  *from = _last_block;
+    block_t **link = nullptr;  // remembers the block for pc
+    if (from) [[likely]] {
+      switch (from->exit) {
+        case block_exit_t::e_call:
+          _returns[_return_top++ % _return_stack_size] = {
+              from->pc + from->size * 4, from};
+          link = &from->links[0];
+          break;
+        case block_exit_t::e_return: {
+          // Note: the stack is only a prediction, a mismatch falls back to
+          // the block cache
+          const return_t &ret = _returns[--_return_top % _return_stack_size];
+          if (ret.caller && ret.pc == pc) link = &ret.caller->links[1];
+          break;
         }
-        throw std::runtime_error("interrupt pending, but not handled");
+        default:
+          // Note: a new successor replaces the older of the two
+          if (is_linked(from->links[1], pc)) {
+            link = &from->links[1];
+          } else {
+            if (!is_linked(from->links[0], pc))
+              from->links[1] = from->links[0];
+            link = &from->links[0];
+          }
+          break;
+      }
+      if (link && is_linked(*link, pc)) [[likely]] {
+        _block_cache_stats.chained++;
+        return _last_block = *link;
       }
     }
+    block_t *block = lookup_block(pc);
+    if (!block) [[unlikely]]
+      block = translate_block(pc, dispatch_table);
+    // Note: translating may have reused the slot the link lives in, a wrong
+    // link never matches
+    if (link) *link = block;
+    return _last_block = block;
+  }
 
-    // no need to check every loop, checking once is enough since jump/branch
+  // picks the slot a block starting at pc is translated into, a free way of
+  // its set if there is one, otherwise the ways are replaced round robin
+  inline uint32_t replace_block(register_t pc) {
+    uint32_t first = block_set(pc) * block_cache_ways;
+    for (uint32_t way = 0; way < block_cache_ways; way++) {
+      const block_t &block = _blocks[first + way];
+      if (block.pc == invalid_block_pc ||
+          block.generation != _block_generation)
+        return first + way;
+    }
+    return first + (_block_replacements++ % block_cache_ways);
+  }
+
+  // drops every block in O(1), blocks of an older generation never match
+  inline void invalidate_blocks() {
+    _block_cache_stats.invalidations++;
+    if (++_block_generation == 0) [[unlikely]] {
+      // Note: a wrapped generation could match blocks from long ago
+      for (auto &block : _blocks) block.pc = invalid_block_pc;
+      _code_pages.clear();
+      _block_generation = 1;
+    }
+    _num_pooled_instructions = 0;
+#ifdef DAWN_JIT
+    _code_cache.used = 0;
+#endif
+  }
+
+  // drops the blocks decoded from a page, for when its contents change
+  // Note: called on every store to a page marked e_c, the page stays unmarked
+  // until code is decoded from it again
+  inline void invalidate_code(register_t page_number) {
+    mark_code_page(page_number, false);
+    auto itr = _code_pages.find(page_number);
+    if (itr == _code_pages.end()) return;
+    if (itr->second.generation == _block_generation) {
+      for (uint32_t index : itr->second.blocks) {
+        // Note: the slot may hold a block of another page by now
+        if (_memory.page_number(_blocks[index].pc) == page_number)
+          _blocks[index].pc = invalid_block_pc;
+      }
+    }
+    _code_pages.erase(itr);
+  }
+
+  static constexpr block_exit_t block_exit(uint32_t last_instruction) {
+    uint32_t opcode = extract_bit_range(last_instruction, 2, 7);
+    uint32_t rd     = extract_bit_range(last_instruction, 7, 12);
+    uint32_t rs1    = extract_bit_range(last_instruction, 15, 20);
+    bool     links  = rd == 1 || rd == 5;
+    if (opcode == 0b11011)  // jal
+      return links ? block_exit_t::e_call : block_exit_t::e_direct;
+    if (opcode != 0b11001) return block_exit_t::e_direct;
+    if (links) return block_exit_t::e_call;
+    return rd == 0 && (rs1 == 1 || rs1 == 5) ? block_exit_t::e_return
+                                             : block_exit_t::e_indirect;
+  }
+
+  // decodes the block starting at pc into the block pool, returns nullptr if
+  // the first instruction cannot be fetched
+  inline block_t *translate_block(register_t pc, void *const *dispatch_table) {
+    [[maybe_unused]] exception_code_t trap_cause;
+    [[maybe_unused]] register_t       trap_value;
+
+    if (_num_pooled_instructions + _max_block_instructions > _block_pool_size)
+        [[unlikely]] {
+      invalidate_blocks();
+    }
+    decoded_instruction_t *instructions =
+        _block_pool + _num_pooled_instructions;
+    uint32_t   size       = 0;
+    register_t current_pc = pc;
+    while (size < _max_block_instructions) {
+      uint32_t instruction;
+      __fetch32(_memory, instruction, current_pc);  // may fault
+      instructions[size++] = decode_instruction(instruction, dispatch_table);
+      current_pc += 4;
+      if (ends_block(instruction) || _memory.page_offset(current_pc) == 0 ||
+          is_watchpoint(current_pc))
+        break;
+    }
+    // Note: a fetch fault ends the block early, the faulting instruction is
+    // fetched again and traps once it starts its own block
+  _do_trap:
+    if (size == 0) return nullptr;
+    for (uint32_t i = 0; i + 1 < size; i++) {
+      uint32_t fused = fused_index(instructions[i], instructions[i + 1]);
+      if (fused) instructions[i++].label = dispatch_table[fused];
+    }
+    _num_pooled_instructions += size;
+    uint32_t slot      = replace_block(pc);
+    block_t &block     = _blocks[slot];
+    block.pc           = pc;
+    block.generation   = _block_generation;
+    block.size         = size;
+    block.instructions = instructions;
+    block.exit         = block_exit(instructions[size - 1].instruction);
+    block.links[0]     = block.links[1] = nullptr;
+    // Note: blocks end at page boundaries, so a block belongs to one page
+    code_page_t &code_page = _code_pages[_memory.page_number(pc)];
+    if (code_page.generation != _block_generation) {
+      code_page.generation = _block_generation;
+      code_page.blocks.clear();
+      mark_code_page(_memory.page_number(pc), true);
+    }
+    code_page.blocks.push_back(slot);
+#ifdef DAWN_JIT
+    block.native     = nullptr;
+    block.executions = 0;
+    block.promoted   = false;
+#endif
+#ifdef DAWN_AOT
+    block.aot = find_aot(pc, instructions, size);
+#endif
+    return &block;
+  }
+#endif
+
+#ifdef DAWN_AOT
+  // loads a module written by examples/aot, replaces the module loaded before
+  // Note: only blocks whose instructions still match the ones the module was
+  // translated from run translated code, so a stale module or code written by
+  // the guest falls back to the interpreter
+  // a key rejects modules translated from other code
+  inline bool load_aot(const char              *path,
+                       std::optional<aot_key_t> key = std::nullopt) {
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) return false;
+    const aot_module_t *module =
+        reinterpret_cast<const aot_module_t *>(dlsym(handle, "dawn_aot_module"));
+    if (!module || module->version != aot_module_version ||
+        module->xlen != sizeof(register_t) * 8 ||
+        (key && module->key != key->value)) {
+      dlclose(handle);
+      return false;
+    }
+    if (_aot.handle) dlclose(_aot.handle);
+    _aot.handle = handle;
+    _aot.module = module;
+    invalidate_blocks();  // blocks translated before pick up the module
+    return true;
+  }
+
+  // loads the module examples/aot left in a cache directory for key, false if
+  // there is none yet
+  inline bool load_aot_cache(const std::filesystem::path &directory,
+                             aot_key_t                    key) {
+    std::filesystem::path path = directory / key.file_name();
+    if (!std::filesystem::exists(path)) return false;
+    return load_aot(path.c_str(), key);
+  }
+
+  inline aot_region_fn_t find_aot(register_t                   pc,
+                                  const decoded_instruction_t *instructions,
+                                  uint32_t                     size) const {
+    const aot_region_t *region = _aot.find(pc);
+    if (!region) return nullptr;
+    const uint32_t *code = region->code + (pc - region->start) / 4;
+    for (uint32_t i = 0; i < size && pc + i * 4 < region->end; i++)
+      if (code[i] != instructions[i].instruction) return nullptr;
+    return region->run;
+  }
+#endif
+
+#if defined(DAWN_JIT) || defined(DAWN_AOT)
+  // also used by code translated ahead of time
+  static const jit_helpers_t *jit_helpers() {
+    static const jit_helpers_t helpers = {
+        .load  = {jit_load<int8_t>, jit_load<int16_t>, jit_load<int32_t>,
+                  jit_load<uint64_t>, jit_load<uint8_t>, jit_load<uint16_t>,
+                  jit_load<uint32_t>, nullptr},
+        .store = {jit_store<uint8_t>, jit_store<uint16_t>, jit_store<uint32_t>,
+                  jit_store<uint64_t>, nullptr, nullptr, nullptr, nullptr},
+    };
+    return &helpers;
+  }
+
+  template <typename type>
+  static bool jit_load(void *machine, register_t addr, register_t *value) {
+    [[maybe_unused]] exception_code_t trap_cause;
+    [[maybe_unused]] register_t       trap_value;
+    machine_t       &m = *reinterpret_cast<machine_t *>(machine);
+    type             loaded;
+    if (addr % sizeof(type) != 0) [[unlikely]]
+      return false;
+    __load(type, m._memory, addr, loaded);
+    *value = static_cast<sregister_t>(loaded);
+    return true;
+  _do_trap:
+    return false;
+  }
+
+  template <typename type>
+  static bool jit_store(void *machine, register_t addr, register_t value) {
+    [[maybe_unused]] exception_code_t trap_cause;
+    [[maybe_unused]] register_t       trap_value;
+    machine_t       &m = *reinterpret_cast<machine_t *>(machine);
+    if (addr % sizeof(type) != 0) [[unlikely]]
+      return false;
+    __store(type, m._memory, addr, value);
+    return true;
+  _do_trap:
+    return false;
+  }
+#endif
+
+#ifdef DAWN_JIT
+  // Note: keeps the block interpreted if its first instruction is not
+  // supported, the code cache is flushed with the blocks when it runs out
+  inline void jit_compile(block_t &block) {
+    if (_code_cache.capacity - _code_cache.used <
+        (block.size + 1) * max_native_instruction_size) [[unlikely]] {
+      invalidate_blocks();
+      return;
+    }
+    block.native = jit_compile_block(_code_cache, block.pc, block.instructions,
+                                     block.size, *jit_helpers());
+  }
+#endif
+
+  // runs n instructions, returns how many were left when the hart started
+  // waiting for an interrupt or run returned early
+  inline uint64_t step(uint64_t n) { return n - run(n).retired; }
+
+  // stops run at the next instruction boundary it checks, for trap callbacks
+  inline void request_exit() {
+    _attention.fetch_or(e_attention_exit, std::memory_order::relaxed);
+  }
+  // same as request_exit but safe to call from any thread, run returns with
+  // e_preempted
+  inline void preempt() {
+    _attention.fetch_or(e_attention_preempt, std::memory_order::relaxed);
+  }
+
+  // clears and reports the attention bit run stops for, exit goes first
+  // Note: only called when exit or preempt is set
+  inline run_exit_t take_attention() {
+    if (_attention.load(std::memory_order::relaxed) & e_attention_exit) {
+      _attention.fetch_and(~e_attention_exit, std::memory_order::relaxed);
+      return run_exit_t::e_exit;
+    }
+    _attention.fetch_and(~e_attention_preempt, std::memory_order::relaxed);
+    return run_exit_t::e_preempted;
+  }
+
+  // run returns before executing the instruction at pc, except for the first
+  // instruction of a run so that it can continue past the watchpoint
+  inline void add_watchpoint(register_t pc) {
+    _watchpoints.insert(pc);
+    _attention.fetch_or(e_attention_watchpoint, std::memory_order::relaxed);
+#ifdef DAWN_INSTRUCTION_CACHE
+    invalidate_blocks();  // watchpoints start their own block
+#endif
+  }
+  inline void remove_watchpoint(register_t pc) {
+    _watchpoints.erase(pc);
+    if (_watchpoints.empty())
+      _attention.fetch_and(~e_attention_watchpoint, std::memory_order::relaxed);
+  }
+
+  inline bool is_watchpoint(register_t pc) const {
+    return !_watchpoints.empty() && _watchpoints.contains(pc);
+  }
+
+  // runs until budget instructions ran or a host visible event happens, the
+  // instructions are taken from _fuel
+  inline run_result_t run(uint64_t budget) {
+    bool         fuel_limited = _fuel < budget;
+    run_result_t result       = execute(fuel_limited ? _fuel : budget);
+    _fuel -= result.retired;
+    if (fuel_limited && result.reason == run_exit_t::e_budget)
+      result.reason = run_exit_t::e_out_of_fuel;
+    return result;
+  }
+
+  // runs for at most duration of wall clock time, a timer thread preempts the
+  // run so the time slice costs nothing on the hot path
+  // Note: a preempt from another thread that races with the end of the time
+  // slice can be lost
+  template <typename rep, typename period>
+  inline run_result_t run_for(
+      std::chrono::duration<rep, period> duration,
+      uint64_t budget = std::numeric_limits<uint64_t>::max()) {
+    _preemption_timer.arm(&_attention, e_attention_preempt,
+                          std::chrono::steady_clock::now() + duration);
+    run_result_t result = run(budget);
+    _preemption_timer.disarm();
+    // the timer may have fired after run returned
+    _attention.fetch_and(~e_attention_preempt, std::memory_order::relaxed);
+    return result;
+  }
+
+#ifndef DAWN_TAIL_CALL
+#ifdef DAWN_SANDBOX
+  // a guest access the host mmu refuses leaves the engine with a
+  // sandbox_fault_t, the engine runs again once the fault is handled
+  inline run_result_t execute(uint64_t budget) {
+    // Note: restored on the way out, a trap callback may throw or run another
+    // machine
+    struct window_guard_t {
+      sandbox_window_t previous;
+      ~window_guard_t() { sandbox_window = previous; }
+    } guard{sandbox_window};
+    sandbox_window = {_memory.ram, _memory.ram + _memory.ram_size,
+                      _memory.ram_base};
+    uint64_t     retired = 0;
+    run_result_t result;
+    do {
+      _sandbox_resume = false;
+      result          = execute_guest(budget - retired);
+      retired += result.retired;
+    } while (_sandbox_resume);
+    return {result.reason, retired};
+  }
+
+  // the access of the instruction faulted at addr, it either is allowed by now
+  // and runs again, a page that was never touched gets allocated like on the
+  // slow path, or it traps with the returned cause
+  // Note: amos fault as the load and then the store they are made of
+  inline std::optional<exception_code_t> sandbox_fault(register_t addr,
+                                                       uint32_t instruction) {
+    uint32_t opcode = extract_bit_range(instruction, 2, 7);
+    uint32_t funct5 = extract_bit_range(instruction, 27, 32);
+    bool     amo    = opcode == 0b01011;
+    bool     reads  = opcode == 0b00000 || (amo && funct5 != 0b00011);
+    bool     writes = opcode == 0b01000 || (amo && funct5 != 0b00010);
+    page_t   page;
+    if (reads) {
+      __get_page(_memory, page_metadata_t::e_r, addr, page);
+      if (!page.ptr) return exception_code_t::e_load_access_fault;
+    }
+    if (writes) {
+      __get_page(_memory, page_metadata_t::e_w, addr, page);
+      if (!page.ptr) return exception_code_t::e_store_access_fault;
+    }
+    _memory.invalidate_page(_memory.page_number(addr));
+    return std::nullopt;
+  }
+
+  inline run_result_t execute_guest(uint64_t budget) {
+#else
+  // TODO: all register accesses need to be converted into register_t
+  // Note: the budget is charged per block, so a run stops exactly after budget
+  // instructions and the next run continues at the following instruction
+  inline run_result_t execute(uint64_t budget) {
+#endif
+    static void *dispatch_table[e_fused_end] = {nullptr};
+    uint64_t     n                           = budget;
+    // Note: pc lives in a local while the loop runs so the compiler keeps it
+    // in a host register, it is written back to _pc before a trap handler, a
+    // host callback or the caller can see it, reg is a plain view of _reg,
+    // trap callbacks write the registers through the machine
+    register_t  pc  = _pc;
+    register_t *reg = _reg;
+
+    // initialize
+    static bool initialized = false;
+    if (!initialized) [[unlikely]] {
+      initialized = true;
+      for (auto &entry : dispatch_table) entry = &&_do_unknown_instruction;
+
+#define register_instr(id, label) \
+  do {                            \
+    dispatch_table[id] = &&label; \
+  } while (false)
+
+      register_instr(e_lui, _do_lui);
+      register_instr(e_auipc, _do_auipc);
+      register_instr(e_jal, _do_jal);
+      register_instr(e_jalr, _do_jalr);
+      register_instr(e_beq, _do_beq);
+      register_instr(e_bne, _do_bne);
+      register_instr(e_blt, _do_blt);
+      register_instr(e_bge, _do_bge);
+      register_instr(e_bltu, _do_bltu);
+      register_instr(e_bgeu, _do_bgeu);
+      register_instr(e_lb, _do_lb);
+      register_instr(e_lh, _do_lh);
+      register_instr(e_lw, _do_lw);
+      register_instr(e_lbu, _do_lbu);
+      register_instr(e_lhu, _do_lhu);
+      register_instr(e_sb, _do_sb);
+      register_instr(e_sh, _do_sh);
+      register_instr(e_sw, _do_sw);
+      register_instr(e_addi, _do_addi);
+      register_instr(e_slti, _do_slti);
+      register_instr(e_sltiu, _do_sltiu);
+      register_instr(e_xori, _do_xori);
+      register_instr(e_ori, _do_ori);
+      register_instr(e_andi, _do_andi);
+      register_instr(e_slli, _do_slli);
+      register_instr(e_srli, _do_srli);
+      register_instr(e_srai, _do_srai);
+      register_instr(e_add, _do_add);
+      register_instr(e_sub, _do_sub);
+      register_instr(e_sll, _do_sll);
+      register_instr(e_slt, _do_slt);
+      register_instr(e_sltu, _do_sltu);
+      register_instr(e_xor, _do_xor);
+      register_instr(e_srl, _do_srl);
+      register_instr(e_sra, _do_sra);
+      register_instr(e_or, _do_or);
+      register_instr(e_and, _do_and);
+      register_instr(e_mul, _do_mul);
+      register_instr(e_mulh, _do_mulh);
+      register_instr(e_mulhsu, _do_mulhsu);
+      register_instr(e_mulhu, _do_mulhu);
+      register_instr(e_div, _do_div);
+      register_instr(e_divu, _do_divu);
+      register_instr(e_rem, _do_rem);
+      register_instr(e_remu, _do_remu);
+      register_instr(e_fence, _do_fence);
+      register_instr(e_fence_i, _do_fence_i);
+      register_instr(e_ecall, _do_ecall);
+      register_instr(e_ebreak, _do_ebreak);
+      register_instr(e_mret, _do_mret);
+      register_instr(e_wfi, _do_wfi);
+      register_instr(e_csrrw, _do_csrrw);
+      register_instr(e_csrrs, _do_csrrs);
+      register_instr(e_csrrc, _do_csrrc);
+      register_instr(e_csrrwi, _do_csrrwi);
+      register_instr(e_csrrsi, _do_csrrsi);
+      register_instr(e_csrrci, _do_csrrci);
+      register_instr(e_lr_w, _do_lr_w);
+      register_instr(e_sc_w, _do_sc_w);
+      register_instr(e_amoswap_w, _do_amoswap_w);
+      register_instr(e_amoadd_w, _do_amoadd_w);
+      register_instr(e_amoxor_w, _do_amoxor_w);
+      register_instr(e_amoand_w, _do_amoand_w);
+      register_instr(e_amoor_w, _do_amoor_w);
+      register_instr(e_amomin_w, _do_amomin_w);
+      register_instr(e_amomax_w, _do_amomax_w);
+      register_instr(e_amominu_w, _do_amominu_w);
+      register_instr(e_amomaxu_w, _do_amomaxu_w);
+#ifdef DAWN_RISCV64
+      register_instr(e_lwu, _do_lwu);
+      register_instr(e_ld, _do_ld);
+      register_instr(e_sd, _do_sd);
+      register_instr(e_addiw, _do_addiw);
+      register_instr(e_slliw, _do_slliw);
+      register_instr(e_srliw, _do_srliw);
+      register_instr(e_sraiw, _do_sraiw);
+      register_instr(e_addw, _do_addw);
+      register_instr(e_subw, _do_subw);
+      register_instr(e_mulw, _do_mulw);
+      register_instr(e_sllw, _do_sllw);
+      register_instr(e_divw, _do_divw);
+      register_instr(e_srlw, _do_srlw);
+      register_instr(e_sraw, _do_sraw);
+      register_instr(e_divuw, _do_divuw);
+      register_instr(e_remw, _do_remw);
+      register_instr(e_remuw, _do_remuw);
+      register_instr(e_lr_d, _do_lr_d);
+      register_instr(e_sc_d, _do_sc_d);
+      register_instr(e_amoswap_d, _do_amoswap_d);
+      register_instr(e_amoadd_d, _do_amoadd_d);
+      register_instr(e_amoxor_d, _do_amoxor_d);
+      register_instr(e_amoand_d, _do_amoand_d);
+      register_instr(e_amoor_d, _do_amoor_d);
+      register_instr(e_amomin_d, _do_amomin_d);
+      register_instr(e_amomax_d, _do_amomax_d);
+      register_instr(e_amominu_d, _do_amominu_d);
+      register_instr(e_amomaxu_d, _do_amomaxu_d);
+#endif
+#ifdef DAWN_INSTRUCTION_CACHE
+      dispatch_table[e_fused_lui_addi]    = &&_do_fused_lui_addi;
+      dispatch_table[e_fused_lui_addiw]   = &&_do_fused_lui_addiw;
+      dispatch_table[e_fused_auipc_addi]  = &&_do_fused_auipc_addi;
+      dispatch_table[e_fused_auipc_jalr]  = &&_do_fused_auipc_jalr;
+      dispatch_table[e_fused_auipc_load]  = &&_do_fused_auipc_load;
+      dispatch_table[e_fused_slli_srli]   = &&_do_fused_slli_srli;
+      dispatch_table[e_fused_slt_branch]  = &&_do_fused_slt_branch;
+      dispatch_table[e_fused_sltu_branch] = &&_do_fused_sltu_branch;
+#endif
+      if constexpr (_is_application) {
+        for (instruction_id_t id : privileged_instructions)
+          dispatch_table[id] = &&_do_unknown_instruction;
+      }
+    }
+
+#define exit_run(reason, retired) \
+  do {                            \
+    _pc = pc;                     \
+    return {reason, retired};     \
+  } while (false)
+
+#ifdef DAWN_INSTRUCTION_CACHE
+    // inst walks the current block, dispatch moves to the next block once it
+    // reaches end
+    const decoded_instruction_t *inst = _block_pool;
+    const decoded_instruction_t *end  = _block_pool + 1;
+#define dispatch()                \
+  do {                            \
+    if (++inst != end) [[likely]] \
+      goto *inst->label;          \
+    goto _next_block;             \
+  } while (false)
+#else
+    decoded_instruction_t        decoded;
+    const decoded_instruction_t *inst = &decoded;
+#ifdef DAWN_PREDECODE
+// Note: pc below the span wraps around to an index past its end
+#define fetch_and_dispatch()                          \
+  do {                                                \
+    if (n-- == 0) [[unlikely]]                        \
+      exit_run(run_exit_t::e_budget, budget);         \
+    register_t __index = (pc - _predecoded_base) / 4; \
+    if (__index >= _predecoded_count) [[unlikely]]    \
+      goto _do_predecode_miss;                        \
+    inst = &_predecoded[__index];                     \
+    goto *inst->label;                                \
+  } while (false)
+#else
+#define fetch_and_dispatch()                                     \
+  do {                                                           \
+    if (n-- == 0) [[unlikely]]                                   \
+      exit_run(run_exit_t::e_budget, budget);                    \
+    uint32_t __instruction;                                      \
+    __fetch32(_memory, __instruction, pc);                       \
+    decoded = decode_instruction(__instruction, dispatch_table); \
+    goto *inst->label;                                           \
+  } while (false)
+#endif
+#define dispatch()                                                \
+  do {                                                            \
+    if (_attention.load(std::memory_order::relaxed)) [[unlikely]] \
+      goto _handle_attention;                                     \
+    fetch_and_dispatch();                                         \
+  } while (false)
+#endif
+
+#ifdef DAWN_ENABLE_LOGGING
+    auto logger = [&]() {
+      _log << "pc: " << std::hex << pc;
+      for (uint32_t i = 0; i < 32; i++) {
+        if (reg[i] != 0) {
+          _log << "    x" << std::dec << i << ": " << std::hex << reg[i];
+        }
+      }
+      _log << '\n';
+      _log.flush();
+    };
+
+#define do_dispatch() \
+  do {                \
+    dispatch();       \
+  } while (false)
+#else
+#define do_dispatch() dispatch()
+#endif
+
+    exception_code_t trap_cause;
+    register_t       trap_value;
+
+#ifdef DAWN_SANDBOX
+    try {
+#endif
+    // host code may have changed anything between runs
+    if constexpr (!_is_application)
+      _attention.fetch_or(e_attention_interrupt, std::memory_order::relaxed);
+
+#ifdef DAWN_PREDECODE
+    if (_predecoded_table != dispatch_table) [[unlikely]]
+      bind_predecoded(dispatch_table, &&_do_predecode_miss);
+#endif
+
+    // no need to check every loop, checking once is enough since jump/branch
     // handle misaligned addresses
-    if (_pc % 4 != 0) [[unlikely]] {
-      do_trap(exception_code_t::e_instruction_address_misaligned, _pc);
+    if (pc % 4 != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_instruction_address_misaligned, pc);
     }
 
     do_dispatch();
 
+    // slow path, taken whenever _attention is not 0
+  _handle_attention: {
+    uint8_t attention = _attention.load(std::memory_order::relaxed);
+    if (!_is_application && (attention & e_attention_interrupt)) {
+      // Note: pairs with the release in write_csr and fetch_or_csr, a later
+      // write sets the bit again
+      _attention.fetch_and(~e_attention_interrupt, std::memory_order::acquire);
+      register_t pending_interrupts = read_csr(MIP) & read_csr(MIE);
+      if (pending_interrupts) {
+        _wfi.store(false, std::memory_order::relaxed);
+        if ((_mode & 0b11) < 0b11 || read_csr(MSTATUS) & MSTATUS_MIE_MASK) {
+#ifdef DAWN_INSTRUCTION_CACHE
+          inst = end - 1;  // the trap is not part of any block
+#endif
+          if (pending_interrupts & MIP_MEIP_MASK) {
+            do_trap(exception_code_t::e_machine_external_interrupt, 0);
+          } else if (pending_interrupts & MIP_MSIP_MASK) {
+            do_trap(exception_code_t::e_machine_software_interrupt, 0);
+          } else if (pending_interrupts & MIP_MTIP_MASK) {
+            do_trap(exception_code_t::e_machine_timer_interrupt, 0);
+          }
+          throw std::runtime_error("interrupt pending, but not handled");
+        }
+      }
+    }
+    if (attention & e_attention_wfi) {
+      if (_wfi.load(std::memory_order::relaxed))
+        exit_run(run_exit_t::e_wfi, budget - n);
+      _attention.fetch_and(~e_attention_wfi, std::memory_order::relaxed);
+    }
+    if (attention & (e_attention_exit | e_attention_preempt))
+      exit_run(take_attention(), budget - n);
+    // Note: n != budget lets a run start at a watchpoint
+    if ((attention & e_attention_watchpoint) && n != budget &&
+        is_watchpoint(pc))
+      exit_run(run_exit_t::e_watchpoint, budget - n);
+  }
+#ifdef DAWN_INSTRUCTION_CACHE
+    goto _run_block;
+#else
+    fetch_and_dispatch();
+#endif
+
+#ifdef DAWN_PREDECODE
+    // pc outside of the span or on a page that is not executable, fetched the
+    // same way as without DAWN_PREDECODE so faults are raised the same way
+  _do_predecode_miss: {
+    uint32_t instruction;
+    __fetch32(_memory, instruction, pc);
+    decoded = decode_instruction(instruction, dispatch_table);
+    inst    = &decoded;
+  }
+    goto *inst->label;
+#endif
+
+#ifdef DAWN_INSTRUCTION_CACHE
+    // budget is charged per block, a block is cut short only when less than
+    // its size is left
+  _next_block: {
+    if (_attention.load(std::memory_order::relaxed)) [[unlikely]]
+      goto _handle_attention;
+  _run_block:
+    if (n == 0) [[unlikely]]
+      exit_run(run_exit_t::e_budget, budget);
+    block_t *block = next_block(pc, dispatch_table);
+    if (!block) [[unlikely]] {
+      // Note: a fetch fault consumes a step like any trapping instruction
+      n--;
+      inst = end - 1;
+      do_trap(exception_code_t::e_instruction_access_fault, pc);
+    }
+    uint64_t size = block->size < n ? block->size : n;
+    n -= size;
+    inst = block->instructions;
+    end  = inst + size;
+#ifdef DAWN_AOT
+    if (block->aot) {
+      // Note: translated code reads pc from _pc and writes it back
+      _pc               = pc;
+      uint64_t executed = block->aot(reg, &_pc, this, jit_helpers(), size);
+      pc                = _pc;
+      if (executed == size) goto _next_block;
+      inst += executed;
+      goto *inst->label;
+    }
+#endif
+#ifdef DAWN_JIT
+    // Note: native code only runs whole blocks, a block cut short by the
+    // budget is interpreted
+    if (size == block->size) [[likely]] {
+      if (block->native) [[likely]] {
+        // Note: native code always writes pc back, through _pc so the local
+        // never has its address taken
+        uint64_t executed = block->native(reg, &_pc, this);
+        pc                = _pc;
+        if (executed == size) goto _next_block;
+        // the rest of the block, starting at the instruction native code
+        // could not run
+        inst += executed;
+        goto *inst->label;
+      }
+      if (!block->promoted && ++block->executions >= _jit_threshold)
+          [[unlikely]] {
+        block->promoted = true;
+        jit_compile(*block);
+      }
+    }
+#endif
+    goto *inst->label;
+  }
+#endif
+
   _do_lui: {
-    _reg[inst.as.u_type.rd()] = static_cast<sregister_t>(
-        static_cast<int32_t>(inst.as.u_type.imm() << 12));
-    _pc += 4;
+    reg[inst->rd] = inst->imm;
+    pc += 4;
   }
     do_dispatch();
 
   _do_auipc: {
-    _reg[inst.as.u_type.rd()] =
-        _pc + static_cast<int32_t>(inst.as.u_type.imm() << 12);
-    _pc += 4;
+    reg[inst->rd] = pc + inst->imm;
+    pc += 4;
   }
     do_dispatch();
 
     // TODO: verify pc is in memory bounds before do_dispatch
   _do_jal: {
-    register_t addr = _pc + inst.as.j_type.imm_sext();
+    register_t addr = pc + inst->imm;
     if (addr % 4 != 0) [[unlikely]] {
       do_trap(exception_code_t::e_instruction_address_misaligned, addr);
     }
-    _reg[inst.as.j_type.rd()] = _pc + 4;
-    _pc                       = addr;
+    reg[inst->rd] = pc + 4;
+    pc            = addr;
   }
     do_dispatch();
 
     // TODO: verify pc is in memory bounds before do_dispatch
   _do_jalr: {
-    register_t target  = _reg[inst.as.i_type.rs1()] + inst.as.i_type.imm_sext();
+    register_t target  = reg[inst->rs1] + inst->imm;
     register_t next_pc = target & ~1ull;
     if (next_pc % 4 != 0) [[unlikely]] {
       do_trap(exception_code_t::e_instruction_address_misaligned, next_pc);
     }
-    _reg[inst.as.i_type.rd()] = _pc + 4;
-    _pc                       = next_pc;
+    reg[inst->rd] = pc + 4;
+    pc            = next_pc;
   }
     do_dispatch();
 
     // TODO: verify pc is in memory bounds before do_dispatch
   _do_beq: {
-    if (_reg[inst.as.b_type.rs1()] == _reg[inst.as.b_type.rs2()]) {
-      register_t addr = _pc + inst.as.b_type.imm_sext();
+    if (reg[inst->rs1] == reg[inst->rs2]) {
+      register_t addr = pc + inst->imm;
       if (addr % 4 != 0) [[unlikely]] {
         do_trap(exception_code_t::e_instruction_address_misaligned, addr);
       }
-      _pc = addr;
+      pc = addr;
     } else {
-      _pc += 4;
+      pc += 4;
     }
   }
     do_dispatch();
 
     // TODO: verify pc is in memory bounds before do_dispatch
   _do_bne: {
-    if (_reg[inst.as.b_type.rs1()] != _reg[inst.as.b_type.rs2()]) {
-      register_t addr = _pc + inst.as.b_type.imm_sext();
+    if (reg[inst->rs1] != reg[inst->rs2]) {
+      register_t addr = pc + inst->imm;
       if (addr % 4 != 0) [[unlikely]] {
         do_trap(exception_code_t::e_instruction_address_misaligned, addr);
       }
-      _pc = addr;
+      pc = addr;
     } else {
-      _pc += 4;
+      pc += 4;
     }
   }
     do_dispatch();
 
     // TODO: verify pc is in memory bounds before do_dispatch
   _do_blt: {
-    if (static_cast<sregister_t>(_reg[inst.as.b_type.rs1()]) <
-        static_cast<sregister_t>(_reg[inst.as.b_type.rs2()])) {
-      register_t addr = _pc + inst.as.b_type.imm_sext();
+    if (static_cast<sregister_t>(reg[inst->rs1]) <
+        static_cast<sregister_t>(reg[inst->rs2])) {
+      register_t addr = pc + inst->imm;
       if (addr % 4 != 0) [[unlikely]] {
         do_trap(exception_code_t::e_instruction_address_misaligned, addr);
       }
-      _pc = addr;
+      pc = addr;
     } else {
-      _pc += 4;
+      pc += 4;
     }
   }
     do_dispatch();
 
     // TODO: verify pc is in memory bounds before do_dispatch
   _do_bge: {
-    if (static_cast<sregister_t>(_reg[inst.as.b_type.rs1()]) >=
-        static_cast<sregister_t>(_reg[inst.as.b_type.rs2()])) {
-      register_t addr = _pc + inst.as.b_type.imm_sext();
+    if (static_cast<sregister_t>(reg[inst->rs1]) >=
+        static_cast<sregister_t>(reg[inst->rs2])) {
+      register_t addr = pc + inst->imm;
       if (addr % 4 != 0) [[unlikely]] {
         do_trap(exception_code_t::e_instruction_address_misaligned, addr);
       }
-      _pc = addr;
+      pc = addr;
     } else {
-      _pc += 4;
+      pc += 4;
     }
   }
     do_dispatch();
 
     // TODO: verify pc is in memory bounds before do_dispatch
   _do_bltu: {
-    if (_reg[inst.as.b_type.rs1()] < _reg[inst.as.b_type.rs2()]) {
-      register_t addr = _pc + inst.as.b_type.imm_sext();
+    if (reg[inst->rs1] < reg[inst->rs2]) {
+      register_t addr = pc + inst->imm;
       if (addr % 4 != 0) [[unlikely]] {
         do_trap(exception_code_t::e_instruction_address_misaligned, addr);
       }
-      _pc = addr;
+      pc = addr;
     } else {
-      _pc += 4;
+      pc += 4;
     }
   }
     do_dispatch();
 
     // TODO: verify pc is in memory bounds before do_dispatch
   _do_bgeu: {
-    if (_reg[inst.as.b_type.rs1()] >= _reg[inst.as.b_type.rs2()]) {
-      register_t addr = _pc + inst.as.b_type.imm_sext();
+    if (reg[inst->rs1] >= reg[inst->rs2]) {
+      register_t addr = pc + inst->imm;
       if (addr % 4 != 0) [[unlikely]] {
         do_trap(exception_code_t::e_instruction_address_misaligned, addr);
       }
-      _pc = addr;
+      pc = addr;
     } else {
-      _pc += 4;
+      pc += 4;
     }
   }
     do_dispatch();
 
   _do_lb: {
-    uint64_t addr = _reg[inst.as.i_type.rs1()] + inst.as.i_type.imm_sext();
+    uint64_t addr = reg[inst->rs1] + inst->imm;
     int8_t   value;
     __load8i(_memory, value, addr);  // may fault
-    _reg[inst.as.i_type.rd()] = static_cast<sregister_t>(value);
-    _pc += 4;
+    reg[inst->rd] = static_cast<sregister_t>(value);
+    pc += 4;
   }
     do_dispatch();
 
   _do_lh: {
-    uint64_t addr = _reg[inst.as.i_type.rs1()] + inst.as.i_type.imm_sext();
+    uint64_t addr = reg[inst->rs1] + inst->imm;
     if (addr % 2 != 0) [[unlikely]] {
       do_trap(exception_code_t::e_load_address_misaligned, addr);
     }
     int16_t value;
     __load16i(_memory, value, addr);  // may fault
-    _reg[inst.as.i_type.rd()] = static_cast<sregister_t>(value);
-    _pc += 4;
+    reg[inst->rd] = static_cast<sregister_t>(value);
+    pc += 4;
   }
     do_dispatch();
 
   _do_lw: {
-    uint64_t addr = _reg[inst.as.i_type.rs1()] + inst.as.i_type.imm_sext();
+    uint64_t addr = reg[inst->rs1] + inst->imm;
     if (addr % 4 != 0) [[unlikely]] {
       do_trap(exception_code_t::e_load_address_misaligned, addr);
     }
     int32_t value;
     __load32i(_memory, value, addr);  // may fault
-    _reg[inst.as.i_type.rd()] = static_cast<sregister_t>(value);
-    _pc += 4;
+    reg[inst->rd] = static_cast<sregister_t>(value);
+    pc += 4;
   }
     do_dispatch();
 
   _do_lbu: {
-    uint64_t addr = _reg[inst.as.i_type.rs1()] + inst.as.i_type.imm_sext();
+    uint64_t addr = reg[inst->rs1] + inst->imm;
     uint8_t  value;
     __load8(_memory, value, addr);  // may fault
-    _reg[inst.as.i_type.rd()] = value;
-    _pc += 4;
+    reg[inst->rd] = value;
+    pc += 4;
   }
     do_dispatch();
 
   _do_lhu: {
-    uint64_t addr = _reg[inst.as.i_type.rs1()] + inst.as.i_type.imm_sext();
+    uint64_t addr = reg[inst->rs1] + inst->imm;
     if (addr % 2 != 0) [[unlikely]] {
       do_trap(exception_code_t::e_load_address_misaligned, addr);
     }
     uint16_t value;
     __load16(_memory, value, addr);  // may fault
-    _reg[inst.as.i_type.rd()] = value;
-    _pc += 4;
+    reg[inst->rd] = value;
+    pc += 4;
   }
     do_dispatch();
 
   _do_sb: {
-    uint64_t addr = _reg[inst.as.s_type.rs1()] + inst.as.s_type.imm_sext();
-    __store8(_memory, addr, _reg[inst.as.s_type.rs2()]);  // may fault
-    _pc += 4;
+    uint64_t addr = reg[inst->rs1] + inst->imm;
+    __store8(_memory, addr, reg[inst->rs2]);  // may fault
+    pc += 4;
   }
     do_dispatch();
 
   _do_sh: {
-    uint64_t addr = _reg[inst.as.s_type.rs1()] + inst.as.s_type.imm_sext();
+    uint64_t addr = reg[inst->rs1] + inst->imm;
     if (addr % 2 != 0) [[unlikely]] {
       do_trap(exception_code_t::e_store_address_misaligned, addr);
     }
-    __store16(_memory, addr, _reg[inst.as.s_type.rs2()]);  // may fault
-    _pc += 4;
+    __store16(_memory, addr, reg[inst->rs2]);  // may fault
+    pc += 4;
   }
     do_dispatch();
 
   _do_sw: {
-    uint64_t addr = _reg[inst.as.s_type.rs1()] + inst.as.s_type.imm_sext();
+    uint64_t addr = reg[inst->rs1] + inst->imm;
     if (addr % 4 != 0) [[unlikely]] {
       do_trap(exception_code_t::e_store_address_misaligned, addr);
     }
-    __store32(_memory, addr, _reg[inst.as.s_type.rs2()]);  // may fault
-    _pc += 4;
+    __store32(_memory, addr, reg[inst->rs2]);  // may fault
+    pc += 4;
   }
     do_dispatch();
 
   _do_addi: {
-    _reg[inst.as.i_type.rd()] =
-        _reg[inst.as.i_type.rs1()] + inst.as.i_type.imm_sext();
-    _pc += 4;
+    reg[inst->rd] = reg[inst->rs1] + inst->imm;
+    pc += 4;
   }
     do_dispatch();
 
   _do_slti: {
-    _reg[inst.as.i_type.rd()] =
-        static_cast<sregister_t>(_reg[inst.as.i_type.rs1()]) <
-        inst.as.i_type.imm_sext();
-    _pc += 4;
+    reg[inst->rd] = static_cast<sregister_t>(reg[inst->rs1]) < inst->imm;
+    pc += 4;
   }
     do_dispatch();
 
   _do_sltiu: {
-    _reg[inst.as.i_type.rd()] =
-        _reg[inst.as.i_type.rs1()] < inst.as.i_type.imm_sext();
-    _pc += 4;
+    reg[inst->rd] = reg[inst->rs1] < inst->imm;
+    pc += 4;
   }
     do_dispatch();
 
   _do_xori: {
-    _reg[inst.as.i_type.rd()] =
-        _reg[inst.as.i_type.rs1()] ^ inst.as.i_type.imm_sext();
-    _pc += 4;
+    reg[inst->rd] = reg[inst->rs1] ^ inst->imm;
+    pc += 4;
   }
     do_dispatch();
 
   _do_ori: {
-    _reg[inst.as.i_type.rd()] =
-        _reg[inst.as.i_type.rs1()] | inst.as.i_type.imm_sext();
-    _pc += 4;
+    reg[inst->rd] = reg[inst->rs1] | inst->imm;
+    pc += 4;
   }
     do_dispatch();
 
   _do_andi: {
-    _reg[inst.as.i_type.rd()] =
-        _reg[inst.as.i_type.rs1()] & inst.as.i_type.imm_sext();
-    _pc += 4;
+    reg[inst->rd] = reg[inst->rs1] & inst->imm;
+    pc += 4;
   }
     do_dispatch();
 
   _do_lwu: {
-    uint64_t addr = _reg[inst.as.i_type.rs1()] + inst.as.i_type.imm_sext();
+    uint64_t addr = reg[inst->rs1] + inst->imm;
     if (addr % 4 != 0) [[unlikely]] {
       do_trap(exception_code_t::e_load_address_misaligned, addr);
     }
     uint32_t value;
     __load32(_memory, value, addr);  // may fault
-    _reg[inst.as.i_type.rd()] = value;
-    _pc += 4;
+    reg[inst->rd] = value;
+    pc += 4;
   }
     do_dispatch();
 
 #ifdef DAWN_RISCV64
   _do_ld: {
-    uint64_t addr = _reg[inst.as.i_type.rs1()] + inst.as.i_type.imm_sext();
+    uint64_t addr = reg[inst->rs1] + inst->imm;
     if (addr % 8 != 0) [[unlikely]] {
       do_trap(exception_code_t::e_load_address_misaligned, addr);
     }
     uint64_t value;
     __load64(_memory, value, addr);  // may fault
-    _reg[inst.as.i_type.rd()] = value;
-    _pc += 4;
+    reg[inst->rd] = value;
+    pc += 4;
   }
     do_dispatch();
 #endif
 
 #ifdef DAWN_RISCV64
   _do_sd: {
-    uint64_t addr = _reg[inst.as.s_type.rs1()] + inst.as.s_type.imm_sext();
+    uint64_t addr = reg[inst->rs1] + inst->imm;
     if (addr % 8 != 0) [[unlikely]] {
       do_trap(exception_code_t::e_store_address_misaligned, addr);
     }
-    __store64(_memory, addr, _reg[inst.as.s_type.rs2()]);  // may fault
-    _pc += 4;
+    __store64(_memory, addr, reg[inst->rs2]);  // may fault
+    pc += 4;
   }
     do_dispatch();
 #endif
 
   _do_slli: {
     constexpr uint32_t shamt_mask = (sizeof(register_t) * 8) - 1;
-    _reg[inst.as.i_type.rd()]     = _reg[inst.as.i_type.rs1()]
-                                << (inst.as.i_type.imm() & shamt_mask);
-    _pc += 4;
+    reg[inst->rd] = reg[inst->rs1] << (inst->imm & shamt_mask);
+    pc += 4;
   }
     do_dispatch();
 
-  _do_srli_or_srai: {
-    switch (inst.as.i_type.imm() >> 6) {
-      case 0b000000: {  // srli
-        constexpr uint32_t shamt_mask = (sizeof(register_t) * 8) - 1;
-        _reg[inst.as.i_type.rd()] =
-            _reg[inst.as.i_type.rs1()] >> (inst.as.i_type.imm() & shamt_mask);
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b010000: {  // srai
-        constexpr uint32_t shamt_mask = (sizeof(register_t) * 8) - 1;
-        sregister_t        rs1_val =
-            static_cast<sregister_t>(_reg[inst.as.i_type.rs1()]);
-        uint32_t shamt            = inst.as.i_type.imm() & shamt_mask;
-        _reg[inst.as.i_type.rd()] = rs1_val >> shamt;
-        _pc += 4;
-        do_dispatch();
-      } break;
+  _do_srli: {
+    constexpr uint32_t shamt_mask = (sizeof(register_t) * 8) - 1;
+    reg[inst->rd] = reg[inst->rs1] >> (inst->imm & shamt_mask);
+    pc += 4;
+  }
+    do_dispatch();
 
-      default:
-        goto _do_unknown_instruction;
-    }
+  _do_srai: {
+    constexpr uint32_t shamt_mask = (sizeof(register_t) * 8) - 1;
+    sregister_t        rs1_val = static_cast<sregister_t>(reg[inst->rs1]);
+    uint32_t           shamt   = inst->imm & shamt_mask;
+    reg[inst->rd]              = rs1_val >> shamt;
+    pc += 4;
   }
     do_dispatch();
 
   _do_addiw: {
-    _reg[inst.as.i_type.rd()] = static_cast<int32_t>(static_cast<uint32_t>(
-        _reg[inst.as.i_type.rs1()] + inst.as.i_type.imm_sext()));
-    _pc += 4;
+    reg[inst->rd] = static_cast<int32_t>(static_cast<uint32_t>(
+        reg[inst->rs1] + inst->imm));
+    pc += 4;
   }
     do_dispatch();
 
   _do_slliw: {
-    _reg[inst.as.i_type.rd()] = static_cast<int32_t>(static_cast<uint32_t>(
-        _reg[inst.as.i_type.rs1()]
-        << static_cast<uint32_t>(inst.as.i_type.shamt_w())));
-    _pc += 4;
-  }
-    do_dispatch();
-
-  _do_srliw_or_sraiw: {
-    switch (inst.as.i_type.imm() >> 5) {
-      case 0b0000000: {  // srliw
-        _reg[inst.as.i_type.rd()] = static_cast<int32_t>(
-            static_cast<uint32_t>(_reg[inst.as.i_type.rs1()]) >>
-            inst.as.i_type.shamt_w());
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0100000: {  // sraiw
-        _reg[inst.as.i_type.rd()] = static_cast<int32_t>(
-            static_cast<int32_t>(_reg[inst.as.i_type.rs1()]) >>
-            inst.as.i_type.shamt_w());
-        _pc += 4;
-        do_dispatch();
-      } break;
-
-      default:
-        goto _do_unknown_instruction;
-    }
-  }
-    do_dispatch();
-
-  _do_addw_or_subw_or_mulw: {
-    switch (inst.as.r_type.funct7()) {
-      case 0b0000000: {  // addw
-        _reg[inst.as.r_type.rd()] = static_cast<int32_t>(
-            static_cast<uint32_t>(_reg[inst.as.r_type.rs1()]) +
-            static_cast<uint32_t>(_reg[inst.as.r_type.rs2()]));
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0100000: {  // subw
-        _reg[inst.as.r_type.rd()] = static_cast<int32_t>(
-            (static_cast<uint32_t>(_reg[inst.as.r_type.rs1()]) -
-             static_cast<uint32_t>(_reg[inst.as.r_type.rs2()])));
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0000001: {  // mulw
-        _reg[inst.as.r_type.rd()] =
-            static_cast<sregister_t>(static_cast<int32_t>(
-                static_cast<uint32_t>(_reg[inst.as.r_type.rs1()]) *
-                static_cast<uint32_t>(_reg[inst.as.r_type.rs2()])));
-        _pc += 4;
-        do_dispatch();
-      } break;
-
-      default:
-        goto _do_unknown_instruction;
-    }
+    reg[inst->rd] = static_cast<int32_t>(static_cast<uint32_t>(
+        reg[inst->rs1] << static_cast<uint32_t>(inst->imm & 0b11111)));
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_srliw: {
+    reg[inst->rd] = static_cast<int32_t>(
+        static_cast<uint32_t>(reg[inst->rs1]) >> (inst->imm & 0b11111));
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_sraiw: {
+    reg[inst->rd] = static_cast<int32_t>(
+        static_cast<int32_t>(reg[inst->rs1]) >> (inst->imm & 0b11111));
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_addw: {
+    reg[inst->rd] = static_cast<int32_t>(
+        static_cast<uint32_t>(reg[inst->rs1]) +
+        static_cast<uint32_t>(reg[inst->rs2]));
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_subw: {
+    reg[inst->rd] = static_cast<int32_t>(
+        (static_cast<uint32_t>(reg[inst->rs1]) -
+         static_cast<uint32_t>(reg[inst->rs2])));
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_mulw: {
+    reg[inst->rd] =
+        static_cast<sregister_t>(static_cast<int32_t>(
+            static_cast<uint32_t>(reg[inst->rs1]) *
+            static_cast<uint32_t>(reg[inst->rs2])));
+    pc += 4;
   }
     do_dispatch();
 
   _do_sllw: {
-    _reg[inst.as.r_type.rd()] = static_cast<sregister_t>(
-        static_cast<int32_t>(static_cast<uint32_t>(_reg[inst.as.r_type.rs1()])
-                             << (_reg[inst.as.r_type.rs2()] & 0b11111)));
-    _pc += 4;
+    reg[inst->rd] = static_cast<sregister_t>(
+        static_cast<int32_t>(static_cast<uint32_t>(reg[inst->rs1])
+                             << (reg[inst->rs2] & 0b11111)));
+    pc += 4;
   }
     do_dispatch();
 
   _do_divw: {
-    int32_t rs1 = static_cast<int32_t>(_reg[inst.as.r_type.rs1()]);
-    int32_t rs2 = static_cast<int32_t>(_reg[inst.as.r_type.rs2()]);
-    if (rs1 == std::numeric_limits<sregister_t>::min() && rs2 == -1) {
-      _reg[inst.as.r_type.rd()] = std::numeric_limits<sregister_t>::min();
+    int32_t rs1 = static_cast<int32_t>(reg[inst->rs1]);
+    int32_t rs2 = static_cast<int32_t>(reg[inst->rs2]);
+    if (rs1 == std::numeric_limits<int32_t>::min() && rs2 == -1) {
+      reg[inst->rd] = std::numeric_limits<sregister_t>::min();
     } else if (rs2 == 0) {
-      _reg[inst.as.r_type.rd()] = ~register_t(0);
+      reg[inst->rd] = ~register_t(0);
     } else [[likely]] {
-      _reg[inst.as.r_type.rd()] = static_cast<register_t>(rs1 / rs2);
-    }
-    _reg[inst.as.r_type.rd()] = static_cast<sregister_t>(
-        static_cast<int32_t>(_reg[inst.as.r_type.rd()]));
-    _pc += 4;
-  }
-    do_dispatch();
-
-  _do_srlw_or_sraw_or_divuw: {
-    switch (inst.as.r_type.funct7()) {
-      case 0b0000000: {  // srlw
-        _reg[inst.as.r_type.rd()] = static_cast<int32_t>(
-            static_cast<uint32_t>(_reg[inst.as.r_type.rs1()]) >>
-            (_reg[inst.as.r_type.rs2()] & 0b11111));
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0100000: {  // sraw
-        _reg[inst.as.r_type.rd()] = static_cast<int32_t>(
-            static_cast<int32_t>(_reg[inst.as.r_type.rs1()]) >>
-            (_reg[inst.as.r_type.rs2()] & 0b11111));
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0000001: {  // divuw
-        uint32_t rs1 = static_cast<uint32_t>(_reg[inst.as.r_type.rs1()]);
-        uint32_t rs2 = static_cast<uint32_t>(_reg[inst.as.r_type.rs2()]);
-        if (rs2 == 0) {
-          _reg[inst.as.r_type.rd()] = ~0u;
-        } else [[likely]] {
-          _reg[inst.as.r_type.rd()] = rs1 / rs2;
-        }
-        _reg[inst.as.r_type.rd()] =
-            static_cast<sregister_t>(static_cast<int32_t>(
-                static_cast<uint32_t>(_reg[inst.as.r_type.rd()])));
-        _pc += 4;
-        do_dispatch();
-      } break;
+      reg[inst->rd] = static_cast<register_t>(rs1 / rs2);
+    }
+    reg[inst->rd] = static_cast<sregister_t>(
+        static_cast<int32_t>(reg[inst->rd]));
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_srlw: {
+    reg[inst->rd] = static_cast<int32_t>(
+        static_cast<uint32_t>(reg[inst->rs1]) >>
+        (reg[inst->rs2] & 0b11111));
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_sraw: {
+    reg[inst->rd] = static_cast<int32_t>(
+        static_cast<int32_t>(reg[inst->rs1]) >>
+        (reg[inst->rs2] & 0b11111));
+    pc += 4;
+  }
+    do_dispatch();
 
-      default:
-        goto _do_unknown_instruction;
+  _do_divuw: {
+    uint32_t rs1 = static_cast<uint32_t>(reg[inst->rs1]);
+    uint32_t rs2 = static_cast<uint32_t>(reg[inst->rs2]);
+    if (rs2 == 0) {
+      reg[inst->rd] = ~0u;
+    } else [[likely]] {
+      reg[inst->rd] = rs1 / rs2;
     }
+    reg[inst->rd] =
+        static_cast<sregister_t>(static_cast<int32_t>(
+            static_cast<uint32_t>(reg[inst->rd])));
+    pc += 4;
   }
     do_dispatch();
 
   _do_remw: {
-    int32_t rs1 = static_cast<int32_t>(_reg[inst.as.r_type.rs1()]);
-    int32_t rs2 = static_cast<int32_t>(_reg[inst.as.r_type.rs2()]);
-    if (rs1 == std::numeric_limits<sregister_t>::min() && rs2 == -1) {
-      _reg[inst.as.r_type.rd()] = 0;
+    int32_t rs1 = static_cast<int32_t>(reg[inst->rs1]);
+    int32_t rs2 = static_cast<int32_t>(reg[inst->rs2]);
+    if (rs1 == std::numeric_limits<int32_t>::min() && rs2 == -1) {
+      reg[inst->rd] = 0;
     } else if (rs2 == 0) {
-      _reg[inst.as.r_type.rd()] = rs1;
+      reg[inst->rd] = rs1;
     } else [[likely]] {
-      _reg[inst.as.r_type.rd()] = static_cast<register_t>(rs1 % rs2);
+      reg[inst->rd] = static_cast<register_t>(rs1 % rs2);
     }
-    _reg[inst.as.r_type.rd()] = static_cast<sregister_t>(
-        static_cast<int32_t>(_reg[inst.as.r_type.rd()]));
-    _pc += 4;
+    reg[inst->rd] = static_cast<sregister_t>(
+        static_cast<int32_t>(reg[inst->rd]));
+    pc += 4;
   }
     do_dispatch();
 
   _do_remuw: {
-    uint32_t rs1 = static_cast<uint32_t>(_reg[inst.as.r_type.rs1()]);
-    uint32_t rs2 = static_cast<uint32_t>(_reg[inst.as.r_type.rs2()]);
+    uint32_t rs1 = static_cast<uint32_t>(reg[inst->rs1]);
+    uint32_t rs2 = static_cast<uint32_t>(reg[inst->rs2]);
     if (rs2 == 0) {
-      _reg[inst.as.r_type.rd()] = rs1;
+      reg[inst->rd] = rs1;
     } else [[likely]] {
-      _reg[inst.as.r_type.rd()] = rs1 % rs2;
-    }
-    _reg[inst.as.r_type.rd()] = static_cast<sregister_t>(
-        static_cast<int32_t>(static_cast<uint32_t>(_reg[inst.as.r_type.rd()])));
-    _pc += 4;
-  }
-    do_dispatch();
-
-  _do_add_or_sub_or_mul: {
-    switch (inst.as.r_type.funct7()) {
-      case 0b0000000: {  // add
-        _reg[inst.as.r_type.rd()] =
-            _reg[inst.as.r_type.rs1()] + _reg[inst.as.r_type.rs2()];
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0100000: {  // sub
-        _reg[inst.as.r_type.rd()] =
-            _reg[inst.as.r_type.rs1()] - _reg[inst.as.r_type.rs2()];
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0000001: {  // mul
-        uint64_t rs1              = _reg[inst.as.r_type.rs1()];
-        uint64_t rs2              = _reg[inst.as.r_type.rs2()];
-        _reg[inst.as.r_type.rd()] = rs1 * rs2;
-        _pc += 4;
-        do_dispatch();
-      } break;
-
-      default:
-        goto _do_unknown_instruction;
-    }
-  }
-    do_dispatch();
-
-  _do_sll_or_mulh: {
-    switch (inst.as.r_type.funct7()) {
-      case 0b0000000: {  // sll
-        constexpr uint32_t shamt_mask = (sizeof(register_t) * 8) - 1;
-        _reg[inst.as.r_type.rd()] =
-            _reg[inst.as.r_type.rs1()]
-            << (_reg[inst.as.r_type.rs2()] & shamt_mask);
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0000001: {  // mulh
-#ifdef DAWN_RISCV64
-        sregister_t rs1 = static_cast<sregister_t>(_reg[inst.as.r_type.rs1()]);
-        sregister_t rs2 = static_cast<sregister_t>(_reg[inst.as.r_type.rs2()]);
-        uint64_t    result[2];
-        mul_64x64_u(rs1, rs2, result);
-        uint64_t result_hi = result[1];
-        if (rs1 < 0) result_hi -= rs2;
-        if (rs2 < 0) result_hi -= rs1;
-        _reg[inst.as.r_type.rd()] = result_hi;
-#else
-        int64_t rs1 = static_cast<int32_t>(_reg[inst.as.r_type.rs1()]);
-        int64_t rs2 = static_cast<int32_t>(_reg[inst.as.r_type.rs2()]);
-        _reg[inst.as.r_type.rd()] = static_cast<uint32_t>((rs1 * rs2) >> 32);
-#endif
-        _pc += 4;
-        do_dispatch();
-      } break;
-
-      default:
-        goto _do_unknown_instruction;
+      reg[inst->rd] = rs1 % rs2;
     }
+    reg[inst->rd] = static_cast<sregister_t>(
+        static_cast<int32_t>(static_cast<uint32_t>(reg[inst->rd])));
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_add: {
+    reg[inst->rd] = reg[inst->rs1] + reg[inst->rs2];
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_sub: {
+    reg[inst->rd] = reg[inst->rs1] - reg[inst->rs2];
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_mul: {
+    uint64_t rs1              = reg[inst->rs1];
+    uint64_t rs2              = reg[inst->rs2];
+    reg[inst->rd] = rs1 * rs2;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_sll: {
+    constexpr uint32_t shamt_mask = (sizeof(register_t) * 8) - 1;
+    reg[inst->rd] = reg[inst->rs1] << (reg[inst->rs2] & shamt_mask);
+    pc += 4;
   }
     do_dispatch();
 
-  _do_slt_or_mulhsu: {
-    switch (inst.as.r_type.funct7()) {
-      case 0b0000000: {  // slt
-        _reg[inst.as.r_type.rd()] =
-            static_cast<sregister_t>(_reg[inst.as.r_type.rs1()]) <
-            static_cast<sregister_t>(_reg[inst.as.r_type.rs2()]);
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0000001: {  // mulhsu
+  _do_mulh: {
 #ifdef DAWN_RISCV64
-        sregister_t rs1 = static_cast<sregister_t>(_reg[inst.as.r_type.rs1()]);
-        uint64_t    rs2 = _reg[inst.as.r_type.rs2()];
-        uint64_t    result[2];
-        mul_64x64_u(rs1, rs2, result);
-        uint64_t result_hi = result[1];
-        if (rs1 < 0) result_hi -= rs2;
-        _reg[inst.as.r_type.rd()] = result_hi;
+    sregister_t rs1 = static_cast<sregister_t>(reg[inst->rs1]);
+    sregister_t rs2 = static_cast<sregister_t>(reg[inst->rs2]);
+    uint64_t    result[2];
+    mul_64x64_u(rs1, rs2, result);
+    uint64_t result_hi = result[1];
+    if (rs1 < 0) result_hi -= rs2;
+    if (rs2 < 0) result_hi -= rs1;
+    reg[inst->rd] = result_hi;
 #else
-        int64_t  rs1 = static_cast<int32_t>(_reg[inst.as.r_type.rs1()]);
-        uint64_t rs2 = static_cast<uint32_t>(_reg[inst.as.r_type.rs2()]);
-        _reg[inst.as.r_type.rd()] = static_cast<uint32_t>((rs1 * rs2) >> 32);
+    int64_t rs1 = static_cast<int32_t>(reg[inst->rs1]);
+    int64_t rs2 = static_cast<int32_t>(reg[inst->rs2]);
+    reg[inst->rd] = static_cast<uint32_t>((rs1 * rs2) >> 32);
 #endif
-        _pc += 4;
-        do_dispatch();
-      } break;
+    pc += 4;
+  }
+    do_dispatch();
 
-      default:
-        goto _do_unknown_instruction;
-    }
+  _do_slt: {
+    reg[inst->rd] =
+        static_cast<sregister_t>(reg[inst->rs1]) <
+        static_cast<sregister_t>(reg[inst->rs2]);
+    pc += 4;
   }
     do_dispatch();
 
-  _do_sltu_or_mulhu: {
-    switch (inst.as.r_type.funct7()) {
-      case 0b0000000: {  // sltu
-        _reg[inst.as.r_type.rd()] =
-            _reg[inst.as.r_type.rs1()] < _reg[inst.as.r_type.rs2()];
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0000001: {  // mulhu
+  _do_mulhsu: {
 #ifdef DAWN_RISCV64
-        uint64_t rs1 = _reg[inst.as.r_type.rs1()];
-        uint64_t rs2 = _reg[inst.as.r_type.rs2()];
-        uint64_t result[2];
-        mul_64x64_u(rs1, rs2, result);
-        _reg[inst.as.r_type.rd()] = result[1];
+    sregister_t rs1 = static_cast<sregister_t>(reg[inst->rs1]);
+    uint64_t    rs2 = reg[inst->rs2];
+    uint64_t    result[2];
+    mul_64x64_u(rs1, rs2, result);
+    uint64_t result_hi = result[1];
+    if (rs1 < 0) result_hi -= rs2;
+    reg[inst->rd] = result_hi;
 #else
-        uint64_t rs1 = static_cast<uint32_t>(_reg[inst.as.r_type.rs1()]);
-        uint64_t rs2 = static_cast<uint32_t>(_reg[inst.as.r_type.rs2()]);
-        _reg[inst.as.r_type.rd()] = static_cast<uint32_t>((rs1 * rs2) >> 32);
-#endif
-        _pc += 4;
-        do_dispatch();
-      } break;
-
-      default:
-        goto _do_unknown_instruction;
-    }
-  }
-    do_dispatch();
-
-  _do_xor_or_div: {
-    switch (inst.as.r_type.funct7()) {
-      case 0b0000000: {  // xor
-        _reg[inst.as.r_type.rd()] =
-            _reg[inst.as.r_type.rs1()] ^ _reg[inst.as.r_type.rs2()];
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0000001: {  // div
-        sregister_t rs1 = static_cast<sregister_t>(_reg[inst.as.r_type.rs1()]);
-        sregister_t rs2 = static_cast<sregister_t>(_reg[inst.as.r_type.rs2()]);
-        if (rs1 == std::numeric_limits<sregister_t>::min() && rs2 == -1) {
-          _reg[inst.as.r_type.rd()] = std::numeric_limits<sregister_t>::min();
-        } else if (rs2 == 0) {
-          _reg[inst.as.r_type.rd()] = ~register_t(0);
-        } else [[likely]] {
-          _reg[inst.as.r_type.rd()] = static_cast<register_t>(rs1 / rs2);
-        }
-        _pc += 4;
-        do_dispatch();
-      } break;
-
-      default:
-        goto _do_unknown_instruction;
-    }
-  }
-    do_dispatch();
-
-  _do_srl_or_sra_or_divu: {
-    switch (inst.as.r_type.funct7()) {
-      case 0b0000000: {  // srl
-        constexpr uint32_t shamt_mask = (sizeof(register_t) * 8) - 1;
-        _reg[inst.as.r_type.rd()]     = _reg[inst.as.r_type.rs1()] >>
-                                    (_reg[inst.as.r_type.rs2()] & shamt_mask);
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0100000: {  // sra
-        constexpr uint32_t shamt_mask = (sizeof(register_t) * 8) - 1;
-        _reg[inst.as.r_type.rd()] =
-            static_cast<sregister_t>(_reg[inst.as.r_type.rs1()]) >>
-            (_reg[inst.as.r_type.rs2()] & shamt_mask);
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0000001: {  // divu
-        uint64_t rs1 = _reg[inst.as.r_type.rs1()];
-        uint64_t rs2 = _reg[inst.as.r_type.rs2()];
-        if (rs2 == 0) {
-          _reg[inst.as.r_type.rd()] = ~register_t(0);
-        } else [[likely]] {
-          _reg[inst.as.r_type.rd()] = rs1 / rs2;
-        }
-        _pc += 4;
-        do_dispatch();
-      } break;
-
-      default:
-        goto _do_unknown_instruction;
-    }
-  }
-    do_dispatch();
-
-  _do_or_or_rem: {
-    switch (inst.as.r_type.funct7()) {
-      case 0b0000000: {  // or
-        _reg[inst.as.r_type.rd()] =
-            _reg[inst.as.r_type.rs1()] | _reg[inst.as.r_type.rs2()];
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0000001: {  // rem
-        sregister_t rs1 = static_cast<sregister_t>(_reg[inst.as.r_type.rs1()]);
-        sregister_t rs2 = static_cast<sregister_t>(_reg[inst.as.r_type.rs2()]);
-        if (rs1 == std::numeric_limits<sregister_t>::min() && rs2 == -1) {
-          _reg[inst.as.r_type.rd()] = 0;
-        } else if (rs2 == 0) {
-          _reg[inst.as.r_type.rd()] = rs1;
-        } else [[likely]] {
-          _reg[inst.as.r_type.rd()] = static_cast<register_t>(rs1 % rs2);
-        }
-        _pc += 4;
-        do_dispatch();
-      } break;
-
-      default:
-        goto _do_unknown_instruction;
-    }
-  }
-    do_dispatch();
-
-  _do_and_or_remu: {
-    switch (inst.as.r_type.funct7()) {
-      case 0b0000000: {  // and
-        _reg[inst.as.r_type.rd()] =
-            _reg[inst.as.r_type.rs1()] & _reg[inst.as.r_type.rs2()];
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b0000001: {  // remu
-        uint64_t rs1 = _reg[inst.as.r_type.rs1()];
-        uint64_t rs2 = _reg[inst.as.r_type.rs2()];
-        if (rs2 == 0) {
-          _reg[inst.as.r_type.rd()] = rs1;
-        } else [[likely]] {
-          _reg[inst.as.r_type.rd()] = rs1 % rs2;
-        }
-        _pc += 4;
-        do_dispatch();
-      } break;
+    int64_t  rs1 = static_cast<int32_t>(reg[inst->rs1]);
+    uint64_t rs2 = static_cast<uint32_t>(reg[inst->rs2]);
+    reg[inst->rd] = static_cast<uint32_t>((rs1 * rs2) >> 32);
+#endif
+    pc += 4;
+  }
+    do_dispatch();
 
-      default:
-        goto _do_unknown_instruction;
-    }
+  _do_sltu: {
+    reg[inst->rd] = reg[inst->rs1] < reg[inst->rs2];
+    pc += 4;
   }
     do_dispatch();
 
-  _do_fence: {
-    // fence not required ?
-    _memory.invalidate_caches();
-#ifdef DAWN_INSTRUCTION_CACHE
-    std::memset(_cached_instructions, 0xff, sizeof(_cached_instructions));
+  _do_mulhu: {
+#ifdef DAWN_RISCV64
+    uint64_t rs1 = reg[inst->rs1];
+    uint64_t rs2 = reg[inst->rs2];
+    uint64_t result[2];
+    mul_64x64_u(rs1, rs2, result);
+    reg[inst->rd] = result[1];
+#else
+    uint64_t rs1 = static_cast<uint32_t>(reg[inst->rs1]);
+    uint64_t rs2 = static_cast<uint32_t>(reg[inst->rs2]);
+    reg[inst->rd] = static_cast<uint32_t>((rs1 * rs2) >> 32);
 #endif
-    _pc += 4;
+    pc += 4;
   }
     do_dispatch();
 
-  _do_system: {
-    switch (inst.as.i_type.imm()) {
-      case 0b000000000000: {  // ecall
-        if (_mode == 0b11) {
-          do_trap(exception_code_t::e_ecall_m_mode, _pc);
-        } else {
-          do_trap(exception_code_t::e_ecall_u_mode, _pc);
-        }
-      }
+  _do_xor: {
+    reg[inst->rd] = reg[inst->rs1] ^ reg[inst->rs2];
+    pc += 4;
+  }
+    do_dispatch();
 
-      case 0b000000000001: {  // ebreak
-        do_trap(exception_code_t::e_breakpoint, _pc);
-      }
+  _do_div: {
+    sregister_t rs1 = static_cast<sregister_t>(reg[inst->rs1]);
+    sregister_t rs2 = static_cast<sregister_t>(reg[inst->rs2]);
+    if (rs1 == std::numeric_limits<sregister_t>::min() && rs2 == -1) {
+      reg[inst->rd] = std::numeric_limits<sregister_t>::min();
+    } else if (rs2 == 0) {
+      reg[inst->rd] = ~register_t(0);
+    } else [[likely]] {
+      reg[inst->rd] = static_cast<register_t>(rs1 / rs2);
+    }
+    pc += 4;
+  }
+    do_dispatch();
 
-      case 0b001100000010: {  // mret
-        if (_mode != 0b11)
-          do_trap(exception_code_t::e_illegal_instruction, inst);
-        register_t mstatus = read_csr(MSTATUS);
-        register_t mpp     = (mstatus & MSTATUS_MPP_MASK) >> MSTATUS_MPP_SHIFT;
-        register_t mpie = (mstatus & MSTATUS_MPIE_MASK) >> MSTATUS_MPIE_SHIFT;
-        _mode           = mpp;
-        _pc             = read_csr(MEPC);
-        mstatus = (mstatus & ~MSTATUS_MIE_MASK) | (mpie << MSTATUS_MIE_SHIFT);
-        mstatus = (mstatus & ~MSTATUS_MPIE_MASK) | (1u << MSTATUS_MPIE_SHIFT);
-        mstatus = (mstatus & ~MSTATUS_MPP_MASK) | (0b00u << MSTATUS_MPP_SHIFT);
-        write_csr(MSTATUS, mstatus);
-        goto _check_for_interrupts;  // no need to break
-      } break;
-
-      case 0b000100000101: {  // wfi
-        _wfi.store(true, std::memory_order::relaxed);
-        if (_wfi_callback) [[likely]]
-          _wfi_callback();
-        _pc += 4;
-        do_dispatch();
-      } break;
-
-      default:
-        goto _do_unknown_instruction;
-    }
-  }
-    do_dispatch();  // technically not needed, just putting for the sake of
-                    // continuity
+  _do_srl: {
+    constexpr uint32_t shamt_mask = (sizeof(register_t) * 8) - 1;
+    reg[inst->rd] = reg[inst->rs1] >> (reg[inst->rs2] & shamt_mask);
+    pc += 4;
+  }
+    do_dispatch();
 
-  _do_csrrw: {
-    // TODO: can reading csr fail ?
-    uint16_t addr = inst.as.i_type.imm();
-    uint64_t csr  = read_csr(addr);
+  _do_sra: {
+    constexpr uint32_t shamt_mask = (sizeof(register_t) * 8) - 1;
+    reg[inst->rd] = static_cast<sregister_t>(reg[inst->rs1]) >>
+                     (reg[inst->rs2] & shamt_mask);
+    pc += 4;
+  }
+    do_dispatch();
 
-    uint8_t rs1 = inst.as.i_type.rs1();
-    if ((addr >> 10) == 0b11 && rs1 != 0) {
-      do_trap(exception_code_t::e_illegal_instruction, inst);
+  _do_divu: {
+    uint64_t rs1 = reg[inst->rs1];
+    uint64_t rs2 = reg[inst->rs2];
+    if (rs2 == 0) {
+      reg[inst->rd] = ~register_t(0);
+    } else [[likely]] {
+      reg[inst->rd] = rs1 / rs2;
     }
+    pc += 4;
+  }
+    do_dispatch();
 
-    write_csr(addr, _reg[rs1]);
-    // write old value to rd
-    _reg[inst.as.i_type.rd()] = csr;
-    _pc += 4;
+  _do_or: {
+    reg[inst->rd] = reg[inst->rs1] | reg[inst->rs2];
+    pc += 4;
   }
-    goto _check_for_interrupts;
+    do_dispatch();
+
+  _do_rem: {
+    sregister_t rs1 = static_cast<sregister_t>(reg[inst->rs1]);
+    sregister_t rs2 = static_cast<sregister_t>(reg[inst->rs2]);
+    if (rs1 == std::numeric_limits<sregister_t>::min() && rs2 == -1) {
+      reg[inst->rd] = 0;
+    } else if (rs2 == 0) {
+      reg[inst->rd] = rs1;
+    } else [[likely]] {
+      reg[inst->rd] = static_cast<register_t>(rs1 % rs2);
+    }
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_and: {
+    reg[inst->rd] = reg[inst->rs1] & reg[inst->rs2];
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_remu: {
+    uint64_t rs1 = reg[inst->rs1];
+    uint64_t rs2 = reg[inst->rs2];
+    if (rs2 == 0) {
+      reg[inst->rd] = rs1;
+    } else [[likely]] {
+      reg[inst->rd] = rs1 % rs2;
+    }
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_fence: {
+    // single hart, memory accesses already happen in order
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_fence_i: {
+#ifdef DAWN_INSTRUCTION_CACHE
+    invalidate_blocks();
+#endif
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_ecall: {
+    if (_is_application || _mode != 0b11) {
+      do_trap(exception_code_t::e_ecall_u_mode, pc);
+    } else {
+      do_trap(exception_code_t::e_ecall_m_mode, pc);
+    }
+  }
+    do_dispatch();
+
+  _do_ebreak: {
+    do_trap(exception_code_t::e_breakpoint, pc);
+  }
+    do_dispatch();
+
+  _do_mret: {
+    if (_mode != 0b11)
+      do_trap(exception_code_t::e_illegal_instruction, inst->instruction);
+    register_t mstatus = read_csr(MSTATUS);
+    register_t mpp     = (mstatus & MSTATUS_MPP_MASK) >> MSTATUS_MPP_SHIFT;
+    register_t mpie = (mstatus & MSTATUS_MPIE_MASK) >> MSTATUS_MPIE_SHIFT;
+    _mode           = mpp;
+    pc              = read_csr(MEPC);
+    mstatus = (mstatus & ~MSTATUS_MIE_MASK) | (mpie << MSTATUS_MIE_SHIFT);
+    mstatus = (mstatus & ~MSTATUS_MPIE_MASK) | (1u << MSTATUS_MPIE_SHIFT);
+    mstatus = (mstatus & ~MSTATUS_MPP_MASK) | (0b00u << MSTATUS_MPP_SHIFT);
+    write_csr(MSTATUS, mstatus);
+  }
+    do_dispatch();
+
+  _do_wfi: {
+    _wfi.store(true, std::memory_order::relaxed);
+    _attention.fetch_or(e_attention_wfi, std::memory_order::relaxed);
+    if (_wfi_callback) [[likely]] {
+      _pc = pc;
+      _wfi_callback();
+    }
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_csrrw: {
+    // TODO: can reading csr fail ?
+    uint16_t addr = inst->imm;
+    uint64_t csr  = read_csr(addr);
+
+    uint8_t rs1 = inst->rs1;
+    if ((addr >> 10) == 0b11 && rs1 != 0) {
+      do_trap(exception_code_t::e_illegal_instruction, inst->instruction);
+    }
+
+    write_csr(addr, reg[rs1]);
+    // write old value to rd
+    reg[inst->rd] = csr;
+    pc += 4;
+  }
+    do_dispatch();
 
   _do_csrrs: {
     // TODO: can reading csr fail ?
-    uint16_t addr = inst.as.i_type.imm();
+    uint16_t addr = inst->imm;
     uint64_t csr  = read_csr(addr);
 
-    uint8_t rs1 = inst.as.i_type.rs1();
+    uint8_t rs1 = inst->rs1;
     if ((addr >> 10) == 0b11 && rs1 != 0) [[unlikely]] {
-      do_trap(exception_code_t::e_illegal_instruction, inst);
+      do_trap(exception_code_t::e_illegal_instruction, inst->instruction);
     }
-    write_csr(addr, csr | _reg[rs1]);
+    write_csr(addr, csr | reg[rs1]);
     // write old value to rd
-    _reg[inst.as.i_type.rd()] = csr;
-    _pc += 4;
+    reg[inst->rd] = csr;
+    pc += 4;
   }
-    goto _check_for_interrupts;
+    do_dispatch();
 
   _do_csrrc: {
     // TODO: can reading csr fail ?
-    uint16_t addr = inst.as.i_type.imm();
+    uint16_t addr = inst->imm;
     uint64_t csr  = read_csr(addr);
 
-    uint8_t rs1 = inst.as.i_type.rs1();
+    uint8_t rs1 = inst->rs1;
     if ((addr >> 10) == 0b11 && rs1 != 0) [[unlikely]] {
-      do_trap(exception_code_t::e_illegal_instruction, inst);
+      do_trap(exception_code_t::e_illegal_instruction, inst->instruction);
     }
-    write_csr(addr, csr & ~_reg[rs1]);
+    write_csr(addr, csr & ~reg[rs1]);
     // write old value to rd
-    _reg[inst.as.i_type.rd()] = csr;
-    _pc += 4;
+    reg[inst->rd] = csr;
+    pc += 4;
   }
-    goto _check_for_interrupts;
+    do_dispatch();
 
   _do_csrrwi: {
     // TODO: can reading csr fail ?
-    uint16_t addr = inst.as.i_type.imm();
+    uint16_t addr = inst->imm;
     uint64_t csr  = read_csr(addr);
 
-    uint8_t rs1 = inst.as.i_type.rs1();
+    uint8_t rs1 = inst->rs1;
     if ((addr >> 10) == 0b11 && rs1 != 0) [[unlikely]] {
-      do_trap(exception_code_t::e_illegal_instruction, inst);
+      do_trap(exception_code_t::e_illegal_instruction, inst->instruction);
     }
     write_csr(addr, rs1);
     // write old value to rd
-    _reg[inst.as.i_type.rd()] = csr;
-    _pc += 4;
+    reg[inst->rd] = csr;
+    pc += 4;
   }
-    goto _check_for_interrupts;
+    do_dispatch();
 
   _do_csrrsi: {
     // TODO: can reading csr fail ?
-    uint16_t addr = inst.as.i_type.imm();
+    uint16_t addr = inst->imm;
     uint64_t csr  = read_csr(addr);
 
-    uint8_t rs1 = inst.as.i_type.rs1();
+    uint8_t rs1 = inst->rs1;
     if ((addr >> 10) == 0b11 && rs1 != 0) [[unlikely]] {
-      do_trap(exception_code_t::e_illegal_instruction, inst);
+      do_trap(exception_code_t::e_illegal_instruction, inst->instruction);
     }
     write_csr(addr, csr | rs1);
     // write old value to rd
-    _reg[inst.as.i_type.rd()] = csr;
-    _pc += 4;
+    reg[inst->rd] = csr;
+    pc += 4;
   }
-    goto _check_for_interrupts;
+    do_dispatch();
 
   _do_csrrci: {
     // TODO: can reading csr fail ?
-    uint16_t addr = inst.as.i_type.imm();
+    uint16_t addr = inst->imm;
     uint64_t csr  = read_csr(addr);
 
-    uint8_t rs1 = inst.as.i_type.rs1();
+    uint8_t rs1 = inst->rs1;
     if ((addr >> 10) == 0b11 && rs1 != 0) [[unlikely]] {
-      do_trap(exception_code_t::e_illegal_instruction, inst);
+      do_trap(exception_code_t::e_illegal_instruction, inst->instruction);
     }
     write_csr(addr, csr & ~rs1);
     // write old value to rd
-    _reg[inst.as.i_type.rd()] = csr;
-    _pc += 4;
-  }
-    goto _check_for_interrupts;
-
-    // TODO: fix all traps, it should be store traps, not load traps
-  _do_atomic_w: {
-    switch (inst.as.a_type.funct5()) {
-      case 0b00010: {  // lr
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 4;  // 4 for w
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint32_t value;
-        __load32(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = sext<32>(value);
-        _reservation_address      = addr;
-        _is_reserved              = true;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b00011: {  // sc
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 4;  // 4 for w
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_store_address_misaligned, addr);
-        }
-        if (_is_reserved && _reservation_address == addr) {
-          __store32(_memory, addr, static_cast<uint32_t>(rs2));
-          _reg[inst.as.a_type.rd()] = 0;
-        } else {
-          _reg[inst.as.a_type.rd()] = 1;
-        }
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b00001: {  // amoswap
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 4;  // 4 for w
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint32_t value;
-        __load32(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = sext<32>(value);
-        __store32(_memory, addr, static_cast<uint32_t>(rs2));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b00000: {  // amoadd
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 4;  // 4 for w
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint32_t value;
-        __load32(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = sext<32>(value);
-        __store32(_memory, addr, static_cast<uint32_t>(value + rs2));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b00100: {  // amoxor
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 4;  // 4 for w
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint32_t value;
-        __load32(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = sext<32>(value);
-        __store32(_memory, addr, static_cast<uint32_t>(value ^ rs2));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b01100: {  // amoand
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 4;  // 4 for w
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint32_t value;
-        __load32(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = sext<32>(value);
-        __store32(_memory, addr, static_cast<uint32_t>(value & rs2));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b01000: {  // amoor
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 4;  // 4 for w
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint32_t value;
-        __load32(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = sext<32>(value);
-        __store32(_memory, addr, static_cast<uint32_t>(value | rs2));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b10000: {  // amomin
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 4;  // 4 for w
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint32_t value;
-        __load32(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = sext<32>(value);
-        __store32(_memory, addr,
-                  static_cast<uint32_t>(std::min(static_cast<int32_t>(value),
-                                                 static_cast<int32_t>(rs2))));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b10100: {  // amomax
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 4;  // 4 for w
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint32_t value;
-        __load32(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = sext<32>(value);
-        __store32(_memory, addr,
-                  static_cast<uint32_t>(std::max(static_cast<int32_t>(value),
-                                                 static_cast<int32_t>(rs2))));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b11000: {  // amominu
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 4;  // 4 for w
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint32_t value;
-        __load32(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = sext<32>(value);
-        __store32(
-            _memory, addr,
-            std::min(static_cast<uint32_t>(value), static_cast<uint32_t>(rs2)));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b11100: {  // amomaxu
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 4;  // 4 for w
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint32_t value;
-        __load32(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = sext<32>(value);
-        __store32(
-            _memory, addr,
-            std::max(static_cast<uint32_t>(value), static_cast<uint32_t>(rs2)));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
+    reg[inst->rd] = csr;
+    pc += 4;
+  }
+    do_dispatch();
+
+    // TODO: a fault of the load half of an amo should be a store trap too
+  _do_lr_w: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 4;  // 4 for w
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_load_address_misaligned, addr);
+    }
+    uint32_t value;
+    __load32(_memory, value, addr);  // may fault
+    reg[inst->rd]        = sext<32>(value);
+    _reservation_address = addr;
+    _is_reserved         = true;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_sc_w: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 4;  // 4 for w
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    if (_is_reserved && _reservation_address == addr) {
+      __store32(_memory, addr, static_cast<uint32_t>(rs2));
+      reg[inst->rd] = 0;
+    } else {
+      reg[inst->rd] = 1;
+    }
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amoswap_w: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 4;  // 4 for w
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint32_t value;
+    __load32(_memory, value, addr);  // may fault
+    reg[inst->rd] = sext<32>(value);
+    __store32(_memory, addr, static_cast<uint32_t>(rs2));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amoadd_w: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 4;  // 4 for w
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint32_t value;
+    __load32(_memory, value, addr);  // may fault
+    reg[inst->rd] = sext<32>(value);
+    __store32(_memory, addr, static_cast<uint32_t>(value + rs2));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amoxor_w: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 4;  // 4 for w
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint32_t value;
+    __load32(_memory, value, addr);  // may fault
+    reg[inst->rd] = sext<32>(value);
+    __store32(_memory, addr, static_cast<uint32_t>(value ^ rs2));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amoand_w: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 4;  // 4 for w
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint32_t value;
+    __load32(_memory, value, addr);  // may fault
+    reg[inst->rd] = sext<32>(value);
+    __store32(_memory, addr, static_cast<uint32_t>(value & rs2));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amoor_w: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 4;  // 4 for w
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint32_t value;
+    __load32(_memory, value, addr);  // may fault
+    reg[inst->rd] = sext<32>(value);
+    __store32(_memory, addr, static_cast<uint32_t>(value | rs2));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amomin_w: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 4;  // 4 for w
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint32_t value;
+    __load32(_memory, value, addr);  // may fault
+    reg[inst->rd] = sext<32>(value);
+    __store32(_memory, addr,
+              static_cast<uint32_t>(std::min(static_cast<int32_t>(value),
+                                             static_cast<int32_t>(rs2))));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amomax_w: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 4;  // 4 for w
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint32_t value;
+    __load32(_memory, value, addr);  // may fault
+    reg[inst->rd] = sext<32>(value);
+    __store32(_memory, addr,
+              static_cast<uint32_t>(std::max(static_cast<int32_t>(value),
+                                             static_cast<int32_t>(rs2))));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
 
-      default:
-        goto _do_unknown_instruction;
+  _do_amominu_w: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 4;  // 4 for w
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
     }
+    uint32_t value;
+    __load32(_memory, value, addr);  // may fault
+    reg[inst->rd] = sext<32>(value);
+    __store32(
+        _memory, addr,
+        std::min(static_cast<uint32_t>(value), static_cast<uint32_t>(rs2)));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amomaxu_w: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 4;  // 4 for w
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint32_t value;
+    __load32(_memory, value, addr);  // may fault
+    reg[inst->rd] = sext<32>(value);
+    __store32(
+        _memory, addr,
+        std::max(static_cast<uint32_t>(value), static_cast<uint32_t>(rs2)));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
   }
     do_dispatch();
 
 #ifdef DAWN_RISCV64
-  _do_atomic_d: {
-    switch (inst.as.a_type.funct5()) {
-      case 0b00010: {  // lr
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 8;  // 8 for d
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint64_t value;
-        __load64(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = value;
-        _reservation_address      = addr;
-        _is_reserved              = true;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b00011: {  // sc
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 8;  // 8 for d
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_store_address_misaligned, addr);
-        }
-        if (_is_reserved && _reservation_address == addr) {
-          // no e_store_access_fault in this implementation
-          __store64(_memory, addr, rs2);
-          _reg[inst.as.a_type.rd()] = 0;
-        } else {
-          _reg[inst.as.a_type.rd()] = 1;
-        }
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b00001: {  // amoswap
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 8;  // 8 for d
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint64_t value;
-        __load64(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = value;
-        __store64(_memory, addr, rs2);
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b00000: {  // amoadd
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 8;  // 8 for d
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint64_t value;
-        __load64(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = value;
-        __store64(_memory, addr, value + rs2);
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b00100: {  // amoxor
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 8;  // 8 for d
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint64_t value;
-        __load64(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = value;
-        __store64(_memory, addr, value ^ rs2);
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b01100: {  // amoand
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 8;  // 8 for d
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint64_t value;
-        __load64(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = value;
-        __store64(_memory, addr, value & rs2);
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b01000: {  // amoor
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 8;  // 8 for d
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint64_t value;
-        __load64(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = value;
-        __store64(_memory, addr, value | rs2);
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b10000: {  // amomin
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 8;  // 8 for d
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint64_t value;
-        __load64(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = value;
-        __store64(_memory, addr,
-                  std::min(static_cast<sregister_t>(value),
-                           static_cast<sregister_t>(rs2)));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b10100: {  // amomax
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 8;  // 8 for d
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint64_t value;
-        __load64(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = value;
-        __store64(_memory, addr,
-                  std::max(static_cast<sregister_t>(value),
-                           static_cast<sregister_t>(rs2)));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b11000: {  // amominu
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 8;  // 8 for d
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint64_t value;
-        __load64(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = value;
-        __store64(_memory, addr,
-                  std::min(static_cast<register_t>(value),
-                           static_cast<register_t>(rs2)));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
-      case 0b11100: {  // amomaxu
-        const uint64_t rs1       = _reg[inst.as.a_type.rs1()];
-        const uint64_t rs2       = _reg[inst.as.a_type.rs2()];
-        const uint64_t addr      = rs1;
-        const uint32_t alignment = 8;  // 8 for d
-        if (addr % alignment != 0) [[unlikely]] {
-          do_trap(exception_code_t::e_load_address_misaligned, addr);
-        }
-        uint64_t value;
-        __load64(_memory, value, addr);  // may fault
-        _reg[inst.as.a_type.rd()] = value;
-        __store64(_memory, addr,
-                  std::max(static_cast<register_t>(value),
-                           static_cast<register_t>(rs2)));
-        _is_reserved         = false;
-        _reservation_address = 0;
-        _pc += 4;
-        do_dispatch();
-      } break;
+  _do_lr_d: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 8;  // 8 for d
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_load_address_misaligned, addr);
+    }
+    uint64_t value;
+    __load64(_memory, value, addr);  // may fault
+    reg[inst->rd]        = value;
+    _reservation_address = addr;
+    _is_reserved         = true;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_sc_d: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 8;  // 8 for d
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    if (_is_reserved && _reservation_address == addr) {
+      // no e_store_access_fault in this implementation
+      __store64(_memory, addr, rs2);
+      reg[inst->rd] = 0;
+    } else {
+      reg[inst->rd] = 1;
+    }
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amoswap_d: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 8;  // 8 for d
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint64_t value;
+    __load64(_memory, value, addr);  // may fault
+    reg[inst->rd] = value;
+    __store64(_memory, addr, rs2);
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amoadd_d: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 8;  // 8 for d
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint64_t value;
+    __load64(_memory, value, addr);  // may fault
+    reg[inst->rd] = value;
+    __store64(_memory, addr, value + rs2);
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amoxor_d: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 8;  // 8 for d
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint64_t value;
+    __load64(_memory, value, addr);  // may fault
+    reg[inst->rd] = value;
+    __store64(_memory, addr, value ^ rs2);
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amoand_d: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 8;  // 8 for d
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint64_t value;
+    __load64(_memory, value, addr);  // may fault
+    reg[inst->rd] = value;
+    __store64(_memory, addr, value & rs2);
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amoor_d: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 8;  // 8 for d
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint64_t value;
+    __load64(_memory, value, addr);  // may fault
+    reg[inst->rd] = value;
+    __store64(_memory, addr, value | rs2);
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amomin_d: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 8;  // 8 for d
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint64_t value;
+    __load64(_memory, value, addr);  // may fault
+    reg[inst->rd] = value;
+    __store64(_memory, addr,
+              std::min(static_cast<sregister_t>(value),
+                       static_cast<sregister_t>(rs2)));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amomax_d: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 8;  // 8 for d
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint64_t value;
+    __load64(_memory, value, addr);  // may fault
+    reg[inst->rd] = value;
+    __store64(_memory, addr,
+              std::max(static_cast<sregister_t>(value),
+                       static_cast<sregister_t>(rs2)));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amominu_d: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 8;  // 8 for d
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint64_t value;
+    __load64(_memory, value, addr);  // may fault
+    reg[inst->rd] = value;
+    __store64(_memory, addr,
+              std::min(static_cast<register_t>(value),
+                       static_cast<register_t>(rs2)));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+
+  _do_amomaxu_d: {
+    const uint64_t rs1       = reg[inst->rs1];
+    const uint64_t rs2       = reg[inst->rs2];
+    const uint64_t addr      = rs1;
+    const uint32_t alignment = 8;  // 8 for d
+    if (addr % alignment != 0) [[unlikely]] {
+      do_trap(exception_code_t::e_store_address_misaligned, addr);
+    }
+    uint64_t value;
+    __load64(_memory, value, addr);  // may fault
+    reg[inst->rd] = value;
+    __store64(_memory, addr,
+              std::max(static_cast<register_t>(value),
+                       static_cast<register_t>(rs2)));
+    _is_reserved         = false;
+    _reservation_address = 0;
+    pc += 4;
+  }
+    do_dispatch();
+#endif
+
+#ifdef DAWN_INSTRUCTION_CACHE
+    // superinstructions run both instructions of their pair and skip the
+    // second slot, which still holds the second instruction's own handler
+    // Note: if the budget cuts the block between the pair only the first
+    // instruction runs. If the second instruction traps, the first one has
+    // already retired and inst points at the second one, as if they ran
+    // separately
+  _do_fused_lui_addi: {
+    if (inst + 1 == end) [[unlikely]]
+      goto _do_lui;
+    reg[inst->rd] = inst[0].imm + inst[1].imm;
+    pc += 8;
+    ++inst;
+  }
+    do_dispatch();
+
+  _do_fused_lui_addiw: {
+    if (inst + 1 == end) [[unlikely]]
+      goto _do_lui;
+    reg[inst->rd] = static_cast<int32_t>(inst[0].imm + inst[1].imm);
+    pc += 8;
+    ++inst;
+  }
+    do_dispatch();
+
+  _do_fused_auipc_addi: {
+    if (inst + 1 == end) [[unlikely]]
+      goto _do_auipc;
+    reg[inst->rd] = pc + inst[0].imm + inst[1].imm;
+    pc += 8;
+    ++inst;
+  }
+    do_dispatch();
+
+  _do_fused_auipc_jalr: {
+    if (inst + 1 == end) [[unlikely]]
+      goto _do_auipc;
+    reg[inst->rd] = pc + inst->imm;
+    pc += 4;
+    ++inst;
+  }
+    goto _do_jalr;
+
+  _do_fused_auipc_load: {
+    if (inst + 1 == end) [[unlikely]]
+      goto _do_auipc;
+    reg[inst->rd] = pc + inst->imm;
+    pc += 4;
+    ++inst;
+  }
+#ifdef DAWN_RISCV64
+    goto _do_ld;
+#else
+    goto _do_lw;
+#endif
+
+  _do_fused_slli_srli: {
+    if (inst + 1 == end) [[unlikely]]
+      goto _do_slli;
+    reg[inst->rd] = static_cast<uint32_t>(reg[inst->rs1]);
+    pc += 8;
+    ++inst;
+  }
+    do_dispatch();
 
-      default:
-        goto _do_unknown_instruction;
+  _do_fused_slt_branch: {
+    if (inst + 1 == end) [[unlikely]]
+      goto _do_slt;
+    register_t value = static_cast<sregister_t>(reg[inst->rs1]) <
+                       static_cast<sregister_t>(reg[inst->rs2]);
+    reg[inst->rd]    = value;
+    pc += 4;
+    ++inst;
+    // beq jumps when value is 0, bne when it is 1
+    if (value == extract_bit_range(inst->instruction, 12, 13)) {
+      register_t addr = pc + inst->imm;
+      if (addr % 4 != 0) [[unlikely]] {
+        do_trap(exception_code_t::e_instruction_address_misaligned, addr);
+      }
+      pc = addr;
+    } else {
+      pc += 4;
+    }
+  }
+    do_dispatch();
+
+  _do_fused_sltu_branch: {
+    if (inst + 1 == end) [[unlikely]]
+      goto _do_sltu;
+    register_t value = reg[inst->rs1] < reg[inst->rs2];
+    reg[inst->rd]    = value;
+    pc += 4;
+    ++inst;
+    // beq jumps when value is 0, bne when it is 1
+    if (value == extract_bit_range(inst->instruction, 12, 13)) {
+      register_t addr = pc + inst->imm;
+      if (addr % 4 != 0) [[unlikely]] {
+        do_trap(exception_code_t::e_instruction_address_misaligned, addr);
+      }
+      pc = addr;
+    } else {
+      pc += 4;
     }
   }
     do_dispatch();
 #endif
 
   _do_unknown_instruction:
-    do_trap(exception_code_t::e_illegal_instruction, _inst);
+    do_trap(exception_code_t::e_illegal_instruction, inst->instruction);
 
   _do_trap:
+#ifdef DAWN_INSTRUCTION_CACHE
+    // the rest of the block does not run, give its budget back
+    n += end - inst - 1;
+    inst = end - 1;
+    // the trap target is not a successor of the block
+    _last_block = nullptr;
+#endif
+    // the trap callback may read and move pc
+    _pc = pc;
     handle_trap(trap_cause, trap_value);
+    pc = _pc;
     do_dispatch();
+#ifdef DAWN_SANDBOX
+    } catch (const sandbox_fault_t &fault) {
+      // Note: pc and inst are still those of the instruction that faulted
+      std::optional<exception_code_t> cause =
+          sandbox_fault(fault.addr, inst->instruction);
+#ifdef DAWN_INSTRUCTION_CACHE
+      // the rest of the block does not run, an access that runs again does
+      // not count either
+      n += end - inst - (cause ? 1 : 0);
+      _last_block = nullptr;
+#else
+      if (!cause) n++;
+#endif
+      _pc = pc;
+      if (cause) handle_trap(*cause, fault.addr);
+      _sandbox_resume = true;
+      return {run_exit_t::e_budget, budget - n};
+    }
+#endif
+  }
+#else
+  // tail call engine, every handler is a small function of its own that ends
+  // by calling the next handler in tail position, the interpreter state is
+  // passed along in arguments so it stays in host registers across handlers
+  // Note: the tail calls are guaranteed with musttail where the compiler has
+  // it, otherwise every handler is built at -O2 whatever the build type, the
+  // sibling call optimisation of -O2 turns the tail calls into jumps, a call
+  // that stays a call would grow the stack on every instruction
+#if __has_cpp_attribute(clang::musttail)
+#define tail_return   [[clang::musttail]] return
+#define tail_sibcalls
+#elif __has_cpp_attribute(gnu::musttail)
+#define tail_return   [[gnu::musttail]] return
+#define tail_sibcalls
+#else
+#define tail_return   return
+#define tail_sibcalls [[gnu::optimize("O2")]]
+#endif
+
+#define tail_args                                                    \
+  machine_t &m, const decoded_instruction_t *inst,                   \
+      const decoded_instruction_t *end, register_t pc,               \
+      register_t *reg, uint64_t n
+#define tail_forward       m, inst, end, pc, reg, n
+// Note: handlers return nothing, the result of the run is left in
+// _tail_result, gcc does not turn calls into jumps once the struct results of
+// two of them get merged
+#define tail_handler(name) tail_sibcalls static void name(tail_args)
+// Note: slow paths stay out of line, once inlined the address taken locals of
+// the memory macros would stop gcc from turning the calls of the fast
+// handlers into jumps, growing the stack on every instruction
+#define tail_slow_handler(name) \
+  [[gnu::noinline]] tail_sibcalls static void name(tail_args)
+
+  using tail_handler_t = void (*)(tail_args);
+
+  static inline tail_handler_t as_handler(void *label) {
+    return reinterpret_cast<tail_handler_t>(label);
+  }
+
+#define tail_exit(reason, retired)      \
+  do {                                  \
+    m._pc          = pc;                \
+    m._tail_result = {reason, retired}; \
+    return;                             \
+  } while (false)
+
+#ifdef DAWN_INSTRUCTION_CACHE
+#define tail_dispatch()                                 \
+  do {                                                  \
+    if (++inst != end) [[likely]]                       \
+      tail_return as_handler(inst->label)(tail_forward); \
+    tail_return tail_next_block(tail_forward);          \
+  } while (false)
+#else
+#define tail_dispatch()                  \
+  do {                                   \
+    tail_return tail_fetch(tail_forward); \
+  } while (false)
+#endif
+
+#define tail_raise(cause, value)          \
+  do {                                    \
+    m._tail_trap_cause = cause;           \
+    m._tail_trap_value = value;           \
+    tail_return tail_trap(tail_forward);  \
+  } while (false)
+
+  // handlers that trap through do_trap, which the memory access macros use,
+  // declare tail_trap_state and end with tail_trap_exit
+#define tail_trap_state          \
+  exception_code_t trap_cause;   \
+  register_t       trap_value
+#define tail_trap_exit() \
+  _do_trap:              \
+  tail_raise(trap_cause, trap_value)
+
+  static void *const *tail_dispatch_table() {
+    // Note: built by the initializer of a function local static, so machines
+    // starting on several threads build it once
+    static void *const *table = [] {
+      static void *dispatch_table[e_fused_end];
+      for (auto &entry : dispatch_table)
+        entry = reinterpret_cast<void *>(tail_unknown_instruction);
+
+      auto register_instr = [](instruction_id_t id, tail_handler_t handler) {
+        dispatch_table[id] = reinterpret_cast<void *>(handler);
+      };
+
+      register_instr(e_lui, tail_lui);
+      register_instr(e_auipc, tail_auipc);
+      register_instr(e_jal, tail_jal);
+      register_instr(e_jalr, tail_jalr);
+      register_instr(e_beq, tail_beq);
+      register_instr(e_bne, tail_bne);
+      register_instr(e_blt, tail_blt);
+      register_instr(e_bge, tail_bge);
+      register_instr(e_bltu, tail_bltu);
+      register_instr(e_bgeu, tail_bgeu);
+      register_instr(e_lb, tail_lb);
+      register_instr(e_lh, tail_lh);
+      register_instr(e_lw, tail_lw);
+      register_instr(e_lbu, tail_lbu);
+      register_instr(e_lhu, tail_lhu);
+      register_instr(e_sb, tail_sb);
+      register_instr(e_sh, tail_sh);
+      register_instr(e_sw, tail_sw);
+      register_instr(e_addi, tail_addi);
+      register_instr(e_slti, tail_slti);
+      register_instr(e_sltiu, tail_sltiu);
+      register_instr(e_xori, tail_xori);
+      register_instr(e_ori, tail_ori);
+      register_instr(e_andi, tail_andi);
+      register_instr(e_slli, tail_slli);
+      register_instr(e_srli, tail_srli);
+      register_instr(e_srai, tail_srai);
+      register_instr(e_add, tail_add);
+      register_instr(e_sub, tail_sub);
+      register_instr(e_sll, tail_sll);
+      register_instr(e_slt, tail_slt);
+      register_instr(e_sltu, tail_sltu);
+      register_instr(e_xor, tail_xor);
+      register_instr(e_srl, tail_srl);
+      register_instr(e_sra, tail_sra);
+      register_instr(e_or, tail_or);
+      register_instr(e_and, tail_and);
+      register_instr(e_mul, tail_mul);
+      register_instr(e_mulh, tail_mulh);
+      register_instr(e_mulhsu, tail_mulhsu);
+      register_instr(e_mulhu, tail_mulhu);
+      register_instr(e_div, tail_div);
+      register_instr(e_divu, tail_divu);
+      register_instr(e_rem, tail_rem);
+      register_instr(e_remu, tail_remu);
+      register_instr(e_fence, tail_fence);
+      register_instr(e_fence_i, tail_fence_i);
+      register_instr(e_ecall, tail_ecall);
+      register_instr(e_ebreak, tail_ebreak);
+      register_instr(e_mret, tail_mret);
+      register_instr(e_wfi, tail_wfi);
+      register_instr(e_csrrw, tail_csrrw);
+      register_instr(e_csrrs, tail_csrrs);
+      register_instr(e_csrrc, tail_csrrc);
+      register_instr(e_csrrwi, tail_csrrwi);
+      register_instr(e_csrrsi, tail_csrrsi);
+      register_instr(e_csrrci, tail_csrrci);
+      register_instr(e_lr_w, tail_lr_w);
+      register_instr(e_sc_w, tail_sc_w);
+      register_instr(e_amoswap_w, tail_amoswap_w);
+      register_instr(e_amoadd_w, tail_amoadd_w);
+      register_instr(e_amoxor_w, tail_amoxor_w);
+      register_instr(e_amoand_w, tail_amoand_w);
+      register_instr(e_amoor_w, tail_amoor_w);
+      register_instr(e_amomin_w, tail_amomin_w);
+      register_instr(e_amomax_w, tail_amomax_w);
+      register_instr(e_amominu_w, tail_amominu_w);
+      register_instr(e_amomaxu_w, tail_amomaxu_w);
+#ifdef DAWN_RISCV64
+      register_instr(e_lwu, tail_lwu);
+      register_instr(e_ld, tail_ld);
+      register_instr(e_sd, tail_sd);
+      register_instr(e_addiw, tail_addiw);
+      register_instr(e_slliw, tail_slliw);
+      register_instr(e_srliw, tail_srliw);
+      register_instr(e_sraiw, tail_sraiw);
+      register_instr(e_addw, tail_addw);
+      register_instr(e_subw, tail_subw);
+      register_instr(e_mulw, tail_mulw);
+      register_instr(e_sllw, tail_sllw);
+      register_instr(e_divw, tail_divw);
+      register_instr(e_srlw, tail_srlw);
+      register_instr(e_sraw, tail_sraw);
+      register_instr(e_divuw, tail_divuw);
+      register_instr(e_remw, tail_remw);
+      register_instr(e_remuw, tail_remuw);
+      register_instr(e_lr_d, tail_lr_d);
+      register_instr(e_sc_d, tail_sc_d);
+      register_instr(e_amoswap_d, tail_amoswap_d);
+      register_instr(e_amoadd_d, tail_amoadd_d);
+      register_instr(e_amoxor_d, tail_amoxor_d);
+      register_instr(e_amoand_d, tail_amoand_d);
+      register_instr(e_amoor_d, tail_amoor_d);
+      register_instr(e_amomin_d, tail_amomin_d);
+      register_instr(e_amomax_d, tail_amomax_d);
+      register_instr(e_amominu_d, tail_amominu_d);
+      register_instr(e_amomaxu_d, tail_amomaxu_d);
+#endif
+#ifdef DAWN_INSTRUCTION_CACHE
+      dispatch_table[e_fused_lui_addi] =
+          reinterpret_cast<void *>(tail_fused_lui_addi);
+      dispatch_table[e_fused_lui_addiw] =
+          reinterpret_cast<void *>(tail_fused_lui_addiw);
+      dispatch_table[e_fused_auipc_addi] =
+          reinterpret_cast<void *>(tail_fused_auipc_addi);
+      dispatch_table[e_fused_auipc_jalr] =
+          reinterpret_cast<void *>(tail_fused_auipc_jalr);
+      dispatch_table[e_fused_auipc_load] =
+          reinterpret_cast<void *>(tail_fused_auipc_load);
+      dispatch_table[e_fused_slli_srli] =
+          reinterpret_cast<void *>(tail_fused_slli_srli);
+      dispatch_table[e_fused_slt_branch] =
+          reinterpret_cast<void *>(tail_fused_slt_branch);
+      dispatch_table[e_fused_sltu_branch] =
+          reinterpret_cast<void *>(tail_fused_sltu_branch);
+#endif
+      if constexpr (_is_application) {
+        for (instruction_id_t id : privileged_instructions)
+          register_instr(id, tail_unknown_instruction);
+      }
+      return static_cast<void *const *>(dispatch_table);
+    }();
+    return table;
+  }
+
+  // same contract as the computed goto execute
+  inline run_result_t execute(uint64_t budget) {
+    _tail_budget = budget;
+#ifdef DAWN_PREDECODE
+    if (_predecoded_table != tail_dispatch_table()) [[unlikely]]
+      bind_predecoded(tail_dispatch_table(),
+                      reinterpret_cast<void *>(tail_predecode_miss));
+#endif
+    // host code may have changed anything between runs
+    if constexpr (!_is_application)
+      _attention.fetch_or(e_attention_interrupt, std::memory_order::relaxed);
+    // the run starts on an empty block, so the first dispatch moves on to
+    // the block at pc
+    const decoded_instruction_t *inst = &_tail_decoded;
+    if (_pc % 4 != 0) [[unlikely]] {
+      _tail_trap_cause = exception_code_t::e_instruction_address_misaligned;
+      _tail_trap_value = _pc;
+      tail_trap(*this, inst, inst + 1, _pc, _reg, budget);
+      return _tail_result;
+    }
+#ifdef DAWN_INSTRUCTION_CACHE
+    tail_next_block(*this, inst, inst + 1, _pc, _reg, budget);
+#else
+    tail_fetch(*this, inst, inst + 1, _pc, _reg, budget);
+#endif
+    return _tail_result;
+  }
+
+  // slow path, taken whenever _attention is not 0
+  tail_slow_handler(tail_handle_attention) {
+    tail_trap_state;
+    uint8_t attention = m._attention.load(std::memory_order::relaxed);
+    if (!_is_application && (attention & e_attention_interrupt)) {
+      // Note: pairs with the release in write_csr and fetch_or_csr, a later
+      // write sets the bit again
+      m._attention.fetch_and(~e_attention_interrupt,
+                             std::memory_order::acquire);
+      register_t pending_interrupts = m.read_csr(MIP) & m.read_csr(MIE);
+      if (pending_interrupts) {
+        m._wfi.store(false, std::memory_order::relaxed);
+        if ((m._mode & 0b11) < 0b11 || m.read_csr(MSTATUS) & MSTATUS_MIE_MASK) {
+#ifdef DAWN_INSTRUCTION_CACHE
+          inst = end - 1;  // the trap is not part of any block
+#endif
+          if (pending_interrupts & MIP_MEIP_MASK) {
+            do_trap(exception_code_t::e_machine_external_interrupt, 0);
+          } else if (pending_interrupts & MIP_MSIP_MASK) {
+            do_trap(exception_code_t::e_machine_software_interrupt, 0);
+          } else if (pending_interrupts & MIP_MTIP_MASK) {
+            do_trap(exception_code_t::e_machine_timer_interrupt, 0);
+          }
+          throw std::runtime_error("interrupt pending, but not handled");
+        }
+      }
+    }
+    if (attention & e_attention_wfi) {
+      if (m._wfi.load(std::memory_order::relaxed))
+        tail_exit(run_exit_t::e_wfi, m._tail_budget - n);
+      m._attention.fetch_and(~e_attention_wfi, std::memory_order::relaxed);
+    }
+    if (attention & (e_attention_exit | e_attention_preempt))
+      tail_exit(m.take_attention(), m._tail_budget - n);
+    // Note: n != budget lets a run start at a watchpoint
+    if ((attention & e_attention_watchpoint) && n != m._tail_budget &&
+        m.is_watchpoint(pc))
+      tail_exit(run_exit_t::e_watchpoint, m._tail_budget - n);
+#ifdef DAWN_INSTRUCTION_CACHE
+    tail_return tail_run_block(tail_forward);
+#else
+    tail_return tail_decode(tail_forward);
+#endif
+    tail_trap_exit();
+  }
+
+#ifdef DAWN_INSTRUCTION_CACHE
+  tail_handler(tail_next_block) {
+    if (m._attention.load(std::memory_order::relaxed)) [[unlikely]]
+      tail_return tail_handle_attention(tail_forward);
+    tail_return tail_run_block(tail_forward);
+  }
+
+  // budget is charged per block, a block is cut short only when less than its
+  // size is left
+  tail_slow_handler(tail_run_block) {
+    tail_trap_state;
+    if (n == 0) [[unlikely]]
+      tail_exit(run_exit_t::e_budget, m._tail_budget);
+    block_t *block = m.next_block(pc, tail_dispatch_table());
+    if (!block) [[unlikely]] {
+      // Note: a fetch fault consumes a step like any trapping instruction
+      n--;
+      inst = end - 1;
+      do_trap(exception_code_t::e_instruction_access_fault, pc);
+    }
+    {
+      uint64_t size = block->size < n ? block->size : n;
+      n -= size;
+      inst = block->instructions;
+      end  = inst + size;
+#ifdef DAWN_AOT
+      if (block->aot) {
+        m._pc = pc;
+        uint64_t executed =
+            block->aot(reg, &m._pc, &m, m.jit_helpers(), size);
+        pc = m._pc;
+        if (executed == size) tail_return tail_next_block(tail_forward);
+        inst += executed;
+        tail_return as_handler(inst->label)(tail_forward);
+      }
+#endif
+#ifdef DAWN_JIT
+      // Note: native code only runs whole blocks, a block cut short by the
+      // budget is interpreted
+      if (size == block->size) [[likely]] {
+        if (block->native) [[likely]] {
+          uint64_t executed = block->native(reg, &m._pc, &m);
+          pc                = m._pc;
+          if (executed == size) tail_return tail_next_block(tail_forward);
+          // the rest of the block, starting at the instruction native code
+          // could not run
+          inst += executed;
+          tail_return as_handler(inst->label)(tail_forward);
+        }
+        if (!block->promoted && ++block->executions >= m._jit_threshold)
+            [[unlikely]] {
+          block->promoted = true;
+          m.jit_compile(*block);
+        }
+      }
+#endif
+    }
+    tail_return as_handler(inst->label)(tail_forward);
+    tail_trap_exit();
+  }
+#else
+  tail_handler(tail_fetch) {
+    if (m._attention.load(std::memory_order::relaxed)) [[unlikely]]
+      tail_return tail_handle_attention(tail_forward);
+    tail_return tail_decode(tail_forward);
+  }
+
+#ifdef DAWN_PREDECODE
+  // Note: pc below the span wraps around to an index past its end
+  tail_handler(tail_decode) {
+    if (n-- == 0) [[unlikely]]
+      tail_exit(run_exit_t::e_budget, m._tail_budget);
+    register_t index = (pc - m._predecoded_base) / 4;
+    if (index >= m._predecoded_count) [[unlikely]]
+      tail_return tail_predecode_miss(tail_forward);
+    inst = &m._predecoded[index];
+    tail_return as_handler(inst->label)(tail_forward);
+  }
+
+  // pc outside of the span or on a page that is not executable, inst points at
+  // _tail_decoded until the next fetch
+  tail_slow_handler(tail_predecode_miss) {
+    tail_trap_state;
+    {
+      uint32_t instruction;
+      __fetch32(m._memory, instruction, pc);
+      m._tail_decoded = decode_instruction(instruction, tail_dispatch_table());
+    }
+    inst = &m._tail_decoded;
+    tail_return as_handler(inst->label)(tail_forward);
+    tail_trap_exit();
+  }
+#else
+  // Note: inst always points at _tail_decoded without the instruction cache
+  tail_slow_handler(tail_decode) {
+    tail_trap_state;
+    if (n-- == 0) [[unlikely]]
+      tail_exit(run_exit_t::e_budget, m._tail_budget);
+    {
+      uint32_t instruction;
+      __fetch32(m._memory, instruction, pc);
+      m._tail_decoded = decode_instruction(instruction, tail_dispatch_table());
+    }
+    tail_return as_handler(inst->label)(tail_forward);
+    tail_trap_exit();
+  }
+#endif
+#endif
+
+  tail_slow_handler(tail_trap) {
+#ifdef DAWN_INSTRUCTION_CACHE
+    // the rest of the block does not run, give its budget back
+    n += end - inst - 1;
+    inst = end - 1;
+    // the trap target is not a successor of the block
+    m._last_block = nullptr;
+#endif
+    // the trap callback may read and move pc
+    m._pc = pc;
+    m.handle_trap(m._tail_trap_cause, m._tail_trap_value);
+    pc = m._pc;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_unknown_instruction) {
+    tail_raise(exception_code_t::e_illegal_instruction, inst->instruction);
+  }
+
+  // rd = expression, for every instruction that only writes rd
+#define tail_alu(name, ...)           \
+  tail_handler(name) {                \
+    reg[inst->rd] = __VA_ARGS__;      \
+    pc += 4;                          \
+    tail_dispatch();                  \
+  }
+
+#define tail_branch(name, ...)                                              \
+  tail_handler(name) {                                                      \
+    if (__VA_ARGS__) {                                                      \
+      register_t addr = pc + inst->imm;                                     \
+      if (addr % 4 != 0) [[unlikely]]                                       \
+        tail_raise(exception_code_t::e_instruction_address_misaligned, addr); \
+      pc = addr;                                                            \
+    } else {                                                                \
+      pc += 4;                                                              \
+    }                                                                       \
+    tail_dispatch();                                                        \
+  }
+
+  // Note: sign extends signed types and zero extends unsigned ones
+#define tail_load(name, type)                                         \
+  tail_handler(name) {                                                \
+    tail_trap_state;                                                  \
+    {                                                                 \
+      register_t addr = reg[inst->rs1] + inst->imm;                   \
+      if (addr % sizeof(type) != 0) [[unlikely]]                      \
+        do_trap(exception_code_t::e_load_address_misaligned, addr);   \
+      type value;                                                     \
+      __load(type, m._memory, addr, value); /* may fault */           \
+      reg[inst->rd] = static_cast<sregister_t>(value);                \
+    }                                                                 \
+    pc += 4;                                                          \
+    tail_dispatch();                                                  \
+    tail_trap_exit();                                                 \
+  }
+
+#define tail_store(name, type)                                         \
+  tail_handler(name) {                                                 \
+    tail_trap_state;                                                   \
+    {                                                                  \
+      register_t addr = reg[inst->rs1] + inst->imm;                    \
+      if (addr % sizeof(type) != 0) [[unlikely]]                       \
+        do_trap(exception_code_t::e_store_address_misaligned, addr);   \
+      __store(type, m._memory, addr, reg[inst->rs2]); /* may fault */  \
+    }                                                                  \
+    pc += 4;                                                           \
+    tail_dispatch();                                                   \
+    tail_trap_exit();                                                  \
+  }
+
+  // rd = old value, memory = expression of value and rs2, a fault of the load
+  // is raised as a load fault, as in execute
+#define tail_amo(name, type, ...)                                       \
+  tail_handler(name) {                                                  \
+    tail_trap_state;                                                    \
+    {                                                                   \
+      using stype          = std::make_signed_t<type>;                  \
+      const register_t addr = reg[inst->rs1];                           \
+      const register_t rs2  = reg[inst->rs2];                           \
+      if (addr % sizeof(type) != 0) [[unlikely]]                        \
+        do_trap(exception_code_t::e_store_address_misaligned, addr);    \
+      type value;                                                       \
+      __load(type, m._memory, addr, value); /* may fault */             \
+      reg[inst->rd] = static_cast<stype>(value);                        \
+      __store(type, m._memory, addr, static_cast<type>(__VA_ARGS__));   \
+      m._is_reserved         = false;                                   \
+      m._reservation_address = 0;                                       \
+    }                                                                   \
+    pc += 4;                                                            \
+    tail_dispatch();                                                    \
+    tail_trap_exit();                                                   \
+  }
+
+#define tail_lr(name, type)                                             \
+  tail_handler(name) {                                                  \
+    tail_trap_state;                                                    \
+    {                                                                   \
+      const register_t addr = reg[inst->rs1];                           \
+      if (addr % sizeof(type) != 0) [[unlikely]]                        \
+        do_trap(exception_code_t::e_load_address_misaligned, addr);     \
+      type value;                                                       \
+      __load(type, m._memory, addr, value); /* may fault */             \
+      reg[inst->rd]          = static_cast<std::make_signed_t<type>>(value); \
+      m._reservation_address = addr;                                    \
+      m._is_reserved         = true;                                    \
+    }                                                                   \
+    pc += 4;                                                            \
+    tail_dispatch();                                                    \
+    tail_trap_exit();                                                   \
+  }
+
+#define tail_sc(name, type)                                             \
+  tail_handler(name) {                                                  \
+    tail_trap_state;                                                    \
+    {                                                                   \
+      const register_t addr = reg[inst->rs1];                           \
+      const register_t rs2  = reg[inst->rs2];                           \
+      if (addr % sizeof(type) != 0) [[unlikely]]                        \
+        do_trap(exception_code_t::e_store_address_misaligned, addr);    \
+      if (m._is_reserved && m._reservation_address == addr) {           \
+        __store(type, m._memory, addr, static_cast<type>(rs2));         \
+        reg[inst->rd] = 0;                                              \
+      } else {                                                          \
+        reg[inst->rd] = 1;                                              \
+      }                                                                 \
+      m._is_reserved         = false;                                   \
+      m._reservation_address = 0;                                       \
+    }                                                                   \
+    pc += 4;                                                            \
+    tail_dispatch();                                                    \
+    tail_trap_exit();                                                   \
+  }
+
+  // csr = expression of csr, rd = old csr
+#define tail_csr(name, ...)                                             \
+  tail_handler(name) {                                                  \
+    uint16_t   addr = inst->imm;                                        \
+    register_t csr  = m.read_csr(addr);                                 \
+    if ((addr >> 10) == 0b11 && inst->rs1 != 0) [[unlikely]]            \
+      tail_raise(exception_code_t::e_illegal_instruction,               \
+                 inst->instruction);                                    \
+    m.write_csr(addr, __VA_ARGS__);                                     \
+    reg[inst->rd] = csr;                                                \
+    pc += 4;                                                            \
+    tail_dispatch();                                                    \
+  }
+
+  tail_alu(tail_lui, inst->imm);
+  tail_alu(tail_auipc, pc + inst->imm);
+
+  tail_handler(tail_jal) {
+    register_t addr = pc + inst->imm;
+    if (addr % 4 != 0) [[unlikely]]
+      tail_raise(exception_code_t::e_instruction_address_misaligned, addr);
+    reg[inst->rd] = pc + 4;
+    pc            = addr;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_jalr) {
+    register_t target  = reg[inst->rs1] + inst->imm;
+    register_t next_pc = target & ~1ull;
+    if (next_pc % 4 != 0) [[unlikely]]
+      tail_raise(exception_code_t::e_instruction_address_misaligned, next_pc);
+    reg[inst->rd] = pc + 4;
+    pc            = next_pc;
+    tail_dispatch();
+  }
+
+  tail_branch(tail_beq, reg[inst->rs1] == reg[inst->rs2]);
+  tail_branch(tail_bne, reg[inst->rs1] != reg[inst->rs2]);
+  tail_branch(tail_blt, static_cast<sregister_t>(reg[inst->rs1]) <
+                            static_cast<sregister_t>(reg[inst->rs2]));
+  tail_branch(tail_bge, static_cast<sregister_t>(reg[inst->rs1]) >=
+                            static_cast<sregister_t>(reg[inst->rs2]));
+  tail_branch(tail_bltu, reg[inst->rs1] < reg[inst->rs2]);
+  tail_branch(tail_bgeu, reg[inst->rs1] >= reg[inst->rs2]);
+
+  tail_load(tail_lb, int8_t);
+  tail_load(tail_lh, int16_t);
+  tail_load(tail_lw, int32_t);
+  tail_load(tail_lbu, uint8_t);
+  tail_load(tail_lhu, uint16_t);
+  tail_store(tail_sb, uint8_t);
+  tail_store(tail_sh, uint16_t);
+  tail_store(tail_sw, uint32_t);
+#ifdef DAWN_RISCV64
+  tail_load(tail_lwu, uint32_t);
+  tail_load(tail_ld, uint64_t);
+  tail_store(tail_sd, uint64_t);
+#endif
+
+  tail_alu(tail_addi, reg[inst->rs1] + inst->imm);
+  tail_alu(tail_slti, static_cast<sregister_t>(reg[inst->rs1]) < inst->imm);
+  tail_alu(tail_sltiu, reg[inst->rs1] < inst->imm);
+  tail_alu(tail_xori, reg[inst->rs1] ^ inst->imm);
+  tail_alu(tail_ori, reg[inst->rs1] | inst->imm);
+  tail_alu(tail_andi, reg[inst->rs1] & inst->imm);
+  tail_alu(tail_slli, reg[inst->rs1]
+                          << (inst->imm & (sizeof(register_t) * 8 - 1)));
+  tail_alu(tail_srli,
+           reg[inst->rs1] >> (inst->imm & (sizeof(register_t) * 8 - 1)));
+  tail_alu(tail_srai, static_cast<sregister_t>(reg[inst->rs1]) >>
+                          (inst->imm & (sizeof(register_t) * 8 - 1)));
+
+#ifdef DAWN_RISCV64
+  tail_alu(tail_addiw, static_cast<int32_t>(
+                           static_cast<uint32_t>(reg[inst->rs1] + inst->imm)));
+  tail_alu(tail_slliw,
+           static_cast<int32_t>(static_cast<uint32_t>(
+               reg[inst->rs1] << static_cast<uint32_t>(inst->imm & 0b11111))));
+  tail_alu(tail_srliw, static_cast<int32_t>(
+                           static_cast<uint32_t>(reg[inst->rs1]) >>
+                           (inst->imm & 0b11111)));
+  tail_alu(tail_sraiw,
+           static_cast<int32_t>(static_cast<int32_t>(reg[inst->rs1]) >>
+                                (inst->imm & 0b11111)));
+
+  tail_alu(tail_addw, static_cast<int32_t>(
+                          static_cast<uint32_t>(reg[inst->rs1]) +
+                          static_cast<uint32_t>(reg[inst->rs2])));
+  tail_alu(tail_subw, static_cast<int32_t>(
+                          static_cast<uint32_t>(reg[inst->rs1]) -
+                          static_cast<uint32_t>(reg[inst->rs2])));
+  tail_alu(tail_mulw, static_cast<int32_t>(
+                          static_cast<uint32_t>(reg[inst->rs1]) *
+                          static_cast<uint32_t>(reg[inst->rs2])));
+
+  tail_alu(tail_sllw,
+           static_cast<int32_t>(static_cast<uint32_t>(reg[inst->rs1])
+                                << (reg[inst->rs2] & 0b11111)));
+  tail_alu(tail_srlw, static_cast<int32_t>(
+                          static_cast<uint32_t>(reg[inst->rs1]) >>
+                          (reg[inst->rs2] & 0b11111)));
+  tail_alu(tail_sraw,
+           static_cast<int32_t>(static_cast<int32_t>(reg[inst->rs1]) >>
+                                (reg[inst->rs2] & 0b11111)));
+
+  tail_handler(tail_divw) {
+    int32_t rs1 = static_cast<int32_t>(reg[inst->rs1]);
+    int32_t rs2 = static_cast<int32_t>(reg[inst->rs2]);
+    int32_t result;
+    if (rs1 == std::numeric_limits<int32_t>::min() && rs2 == -1) {
+      result = rs1;
+    } else if (rs2 == 0) {
+      result = -1;
+    } else [[likely]] {
+      result = rs1 / rs2;
+    }
+    reg[inst->rd] = static_cast<sregister_t>(result);
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_divuw) {
+    uint32_t rs1    = static_cast<uint32_t>(reg[inst->rs1]);
+    uint32_t rs2    = static_cast<uint32_t>(reg[inst->rs2]);
+    uint32_t result = rs2 == 0 ? ~0u : rs1 / rs2;
+    reg[inst->rd]   = static_cast<int32_t>(result);
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_remw) {
+    int32_t rs1 = static_cast<int32_t>(reg[inst->rs1]);
+    int32_t rs2 = static_cast<int32_t>(reg[inst->rs2]);
+    int32_t result;
+    if (rs1 == std::numeric_limits<int32_t>::min() && rs2 == -1) {
+      result = 0;
+    } else if (rs2 == 0) {
+      result = rs1;
+    } else [[likely]] {
+      result = rs1 % rs2;
+    }
+    reg[inst->rd] = static_cast<sregister_t>(result);
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_remuw) {
+    uint32_t rs1    = static_cast<uint32_t>(reg[inst->rs1]);
+    uint32_t rs2    = static_cast<uint32_t>(reg[inst->rs2]);
+    uint32_t result = rs2 == 0 ? rs1 : rs1 % rs2;
+    reg[inst->rd]   = static_cast<int32_t>(result);
+    pc += 4;
+    tail_dispatch();
+  }
+#endif
+
+  tail_alu(tail_add, reg[inst->rs1] + reg[inst->rs2]);
+  tail_alu(tail_sub, reg[inst->rs1] - reg[inst->rs2]);
+  tail_alu(tail_mul, reg[inst->rs1] * reg[inst->rs2]);
+  tail_alu(tail_sll, reg[inst->rs1]
+                         << (reg[inst->rs2] & (sizeof(register_t) * 8 - 1)));
+  tail_alu(tail_slt, static_cast<sregister_t>(reg[inst->rs1]) <
+                         static_cast<sregister_t>(reg[inst->rs2]));
+  tail_alu(tail_sltu, reg[inst->rs1] < reg[inst->rs2]);
+  tail_alu(tail_xor, reg[inst->rs1] ^ reg[inst->rs2]);
+  tail_alu(tail_srl,
+           reg[inst->rs1] >> (reg[inst->rs2] & (sizeof(register_t) * 8 - 1)));
+  tail_alu(tail_sra, static_cast<sregister_t>(reg[inst->rs1]) >>
+                         (reg[inst->rs2] & (sizeof(register_t) * 8 - 1)));
+  tail_alu(tail_or, reg[inst->rs1] | reg[inst->rs2]);
+  tail_alu(tail_and, reg[inst->rs1] & reg[inst->rs2]);
+
+  tail_handler(tail_mulh) {
+#ifdef DAWN_RISCV64
+    sregister_t rs1 = static_cast<sregister_t>(reg[inst->rs1]);
+    sregister_t rs2 = static_cast<sregister_t>(reg[inst->rs2]);
+    uint64_t    result[2];
+    mul_64x64_u(rs1, rs2, result);
+    uint64_t result_hi = result[1];
+    if (rs1 < 0) result_hi -= rs2;
+    if (rs2 < 0) result_hi -= rs1;
+    reg[inst->rd] = result_hi;
+#else
+    int64_t rs1   = static_cast<int32_t>(reg[inst->rs1]);
+    int64_t rs2   = static_cast<int32_t>(reg[inst->rs2]);
+    reg[inst->rd] = static_cast<uint32_t>((rs1 * rs2) >> 32);
+#endif
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_mulhsu) {
+#ifdef DAWN_RISCV64
+    sregister_t rs1 = static_cast<sregister_t>(reg[inst->rs1]);
+    uint64_t    rs2 = reg[inst->rs2];
+    uint64_t    result[2];
+    mul_64x64_u(rs1, rs2, result);
+    uint64_t result_hi = result[1];
+    if (rs1 < 0) result_hi -= rs2;
+    reg[inst->rd] = result_hi;
+#else
+    int64_t  rs1  = static_cast<int32_t>(reg[inst->rs1]);
+    uint64_t rs2  = static_cast<uint32_t>(reg[inst->rs2]);
+    reg[inst->rd] = static_cast<uint32_t>((rs1 * rs2) >> 32);
+#endif
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_mulhu) {
+#ifdef DAWN_RISCV64
+    uint64_t result[2];
+    mul_64x64_u(reg[inst->rs1], reg[inst->rs2], result);
+    reg[inst->rd] = result[1];
+#else
+    uint64_t rs1  = static_cast<uint32_t>(reg[inst->rs1]);
+    uint64_t rs2  = static_cast<uint32_t>(reg[inst->rs2]);
+    reg[inst->rd] = static_cast<uint32_t>((rs1 * rs2) >> 32);
+#endif
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_div) {
+    sregister_t rs1 = static_cast<sregister_t>(reg[inst->rs1]);
+    sregister_t rs2 = static_cast<sregister_t>(reg[inst->rs2]);
+    if (rs1 == std::numeric_limits<sregister_t>::min() && rs2 == -1) {
+      reg[inst->rd] = std::numeric_limits<sregister_t>::min();
+    } else if (rs2 == 0) {
+      reg[inst->rd] = ~register_t(0);
+    } else [[likely]] {
+      reg[inst->rd] = static_cast<register_t>(rs1 / rs2);
+    }
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_divu) {
+    register_t rs1 = reg[inst->rs1];
+    register_t rs2 = reg[inst->rs2];
+    reg[inst->rd]  = rs2 == 0 ? ~register_t(0) : rs1 / rs2;
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_rem) {
+    sregister_t rs1 = static_cast<sregister_t>(reg[inst->rs1]);
+    sregister_t rs2 = static_cast<sregister_t>(reg[inst->rs2]);
+    if (rs1 == std::numeric_limits<sregister_t>::min() && rs2 == -1) {
+      reg[inst->rd] = 0;
+    } else if (rs2 == 0) {
+      reg[inst->rd] = rs1;
+    } else [[likely]] {
+      reg[inst->rd] = static_cast<register_t>(rs1 % rs2);
+    }
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_remu) {
+    register_t rs1 = reg[inst->rs1];
+    register_t rs2 = reg[inst->rs2];
+    reg[inst->rd]  = rs2 == 0 ? rs1 : rs1 % rs2;
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_fence) {
+    // single hart, memory accesses already happen in order
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_fence_i) {
+#ifdef DAWN_INSTRUCTION_CACHE
+    m.invalidate_blocks();
+#endif
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_ecall) {
+    if (!_is_application && m._mode == 0b11)
+      tail_raise(exception_code_t::e_ecall_m_mode, pc);
+    tail_raise(exception_code_t::e_ecall_u_mode, pc);
+  }
+
+  tail_handler(tail_ebreak) {
+    tail_raise(exception_code_t::e_breakpoint, pc);
+  }
+
+  tail_handler(tail_mret) {
+    if (m._mode != 0b11)
+      tail_raise(exception_code_t::e_illegal_instruction, inst->instruction);
+    register_t mstatus = m.read_csr(MSTATUS);
+    register_t mpp     = (mstatus & MSTATUS_MPP_MASK) >> MSTATUS_MPP_SHIFT;
+    register_t mpie    = (mstatus & MSTATUS_MPIE_MASK) >> MSTATUS_MPIE_SHIFT;
+    m._mode            = mpp;
+    pc                 = m.read_csr(MEPC);
+    mstatus = (mstatus & ~MSTATUS_MIE_MASK) | (mpie << MSTATUS_MIE_SHIFT);
+    mstatus = (mstatus & ~MSTATUS_MPIE_MASK) | (1u << MSTATUS_MPIE_SHIFT);
+    mstatus = (mstatus & ~MSTATUS_MPP_MASK) | (0b00u << MSTATUS_MPP_SHIFT);
+    m.write_csr(MSTATUS, mstatus);
+    tail_dispatch();
+  }
+
+  tail_handler(tail_wfi) {
+    m._wfi.store(true, std::memory_order::relaxed);
+    m._attention.fetch_or(e_attention_wfi, std::memory_order::relaxed);
+    if (m._wfi_callback) [[likely]] {
+      m._pc = pc;
+      m._wfi_callback();
+    }
+    pc += 4;
+    tail_dispatch();
+  }
+
+  tail_csr(tail_csrrw, reg[inst->rs1]);
+  tail_csr(tail_csrrs, csr | reg[inst->rs1]);
+  tail_csr(tail_csrrc, csr & ~reg[inst->rs1]);
+  tail_csr(tail_csrrwi, inst->rs1);
+  tail_csr(tail_csrrsi, csr | inst->rs1);
+  tail_csr(tail_csrrci, csr & ~inst->rs1);
+
+  // one set of handlers per access size
+#define tail_atomics(size, type)                                      \
+  tail_lr(tail_lr_##size, type);                                      \
+  tail_sc(tail_sc_##size, type);                                      \
+  tail_amo(tail_amoswap_##size, type, rs2);                           \
+  tail_amo(tail_amoadd_##size, type, value + rs2);                    \
+  tail_amo(tail_amoxor_##size, type, value ^ rs2);                    \
+  tail_amo(tail_amoand_##size, type, value & rs2);                    \
+  tail_amo(tail_amoor_##size, type, value | rs2);                     \
+  tail_amo(tail_amomin_##size, type, std::min<stype>(value, rs2));    \
+  tail_amo(tail_amomax_##size, type, std::max<stype>(value, rs2));    \
+  tail_amo(tail_amominu_##size, type, std::min<type>(value, rs2));    \
+  tail_amo(tail_amomaxu_##size, type, std::max<type>(value, rs2));
+
+  tail_atomics(w, uint32_t);
+#ifdef DAWN_RISCV64
+  tail_atomics(d, uint64_t);
+#endif
+
+#ifdef DAWN_INSTRUCTION_CACHE
+  // superinstructions, same contract as in the computed goto engine
+  tail_handler(tail_fused_lui_addi) {
+    if (inst + 1 == end) [[unlikely]]
+      tail_return tail_lui(tail_forward);
+    reg[inst->rd] = inst[0].imm + inst[1].imm;
+    pc += 8;
+    ++inst;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_fused_lui_addiw) {
+    if (inst + 1 == end) [[unlikely]]
+      tail_return tail_lui(tail_forward);
+    reg[inst->rd] = static_cast<int32_t>(inst[0].imm + inst[1].imm);
+    pc += 8;
+    ++inst;
+    tail_dispatch();
+  }
+
+  tail_handler(tail_fused_auipc_addi) {
+    if (inst + 1 == end) [[unlikely]]
+      tail_return tail_auipc(tail_forward);
+    reg[inst->rd] = pc + inst[0].imm + inst[1].imm;
+    pc += 8;
+    ++inst;
+    tail_dispatch();
   }
 
+  tail_handler(tail_fused_auipc_jalr) {
+    if (inst + 1 == end) [[unlikely]]
+      tail_return tail_auipc(tail_forward);
+    reg[inst->rd] = pc + inst->imm;
+    pc += 4;
+    ++inst;
+    tail_return tail_jalr(tail_forward);
+  }
+
+  tail_handler(tail_fused_auipc_load) {
+    if (inst + 1 == end) [[unlikely]]
+      tail_return tail_auipc(tail_forward);
+    reg[inst->rd] = pc + inst->imm;
+    pc += 4;
+    ++inst;
+#ifdef DAWN_RISCV64
+    tail_return tail_ld(tail_forward);
+#else
+    tail_return tail_lw(tail_forward);
+#endif
+  }
+
+  tail_handler(tail_fused_slli_srli) {
+    if (inst + 1 == end) [[unlikely]]
+      tail_return tail_slli(tail_forward);
+    reg[inst->rd] = static_cast<uint32_t>(reg[inst->rs1]);
+    pc += 8;
+    ++inst;
+    tail_dispatch();
+  }
+
+  // beq jumps when value is 0, bne when it is 1
+#define tail_fused_set_branch(name, set, ...)                               \
+  tail_handler(name) {                                                      \
+    if (inst + 1 == end) [[unlikely]]                                       \
+      tail_return set(tail_forward);                                        \
+    register_t value = __VA_ARGS__;                                         \
+    reg[inst->rd]    = value;                                               \
+    pc += 4;                                                                \
+    ++inst;                                                                 \
+    if (value == extract_bit_range(inst->instruction, 12, 13)) {            \
+      register_t addr = pc + inst->imm;                                     \
+      if (addr % 4 != 0) [[unlikely]]                                       \
+        tail_raise(exception_code_t::e_instruction_address_misaligned, addr); \
+      pc = addr;                                                            \
+    } else {                                                                \
+      pc += 4;                                                              \
+    }                                                                       \
+    tail_dispatch();                                                        \
+  }
+
+  tail_fused_set_branch(tail_fused_slt_branch, tail_slt,
+                        static_cast<sregister_t>(reg[inst->rs1]) <
+                            static_cast<sregister_t>(reg[inst->rs2]));
+  tail_fused_set_branch(tail_fused_sltu_branch, tail_sltu,
+                        reg[inst->rs1] < reg[inst->rs2]);
+#endif
+#endif
+
   // memory
-  memory_t<direct_cache_size, bits_per_page> _memory;
+  memory_t<tlb_size, bits_per_page, tlb_ways> _memory;
   // const size_t _ram_size;
   // uint8_t     *_data;
   // uint64_t     _offset{};
   // uint8_t     *_final{};
 
 #ifdef DAWN_INSTRUCTION_CACHE
-  static const register_t _bits_per_instruction_cache = 12;
-  static const register_t _num_instruction_cache =
-      1 << _bits_per_instruction_cache;
-  cached_instruction_t _cached_instructions[_num_instruction_cache];
+  static const register_t invalid_block_pc =
+      std::numeric_limits<register_t>::max();
+  static const register_t _num_block_sets = 1 << bits_per_block_cache;
+  static const register_t _num_blocks     = _num_block_sets * block_cache_ways;
+  static const register_t _max_block_instructions = 32;
+  // Note: room for 4 instructions per block slot, but at least one full block
+  static const register_t _block_pool_size =
+      _num_blocks * 4 > _max_block_instructions ? _num_blocks * 4
+                                                : _max_block_instructions;
+  block_t               _blocks[_num_blocks];
+  decoded_instruction_t _block_pool[_block_pool_size];
+  register_t            _num_pooled_instructions = 0;
+  uint32_t              _block_generation        = 1;
+  uint32_t              _block_replacements      = 0;
+  block_cache_stats_t   _block_cache_stats       = {};
+  // the block that ran last, nullptr after a trap
+  block_t *_last_block = nullptr;
+  // return address stack, pushed by blocks that end in a call, a return pops
+  // the caller whose links[1] is the block it returns to
+  struct return_t {
+    register_t pc     = invalid_block_pc;
+    block_t   *caller = nullptr;
+  };
+  static const uint32_t _return_stack_size = 16;
+  return_t              _returns[_return_stack_size];
+  uint32_t              _return_top        = 0;
+  // block slots translated from a page in its generation, stale slots are
+  // skipped when the page is invalidated
+  struct code_page_t {
+    uint32_t              generation = 0;  // 0 is never a block generation
+    std::vector<uint32_t> blocks;
+  };
+  std::unordered_map<register_t, code_page_t> _code_pages;
+#endif
+
+#ifdef DAWN_PREDECODE
+  // Note: a decoded instruction takes 24 bytes on rv64
+  static const register_t _max_predecoded_instructions = 1 << 22;
+  std::vector<decoded_instruction_t> _predecoded;
+  register_t                         _predecoded_base  = 0;
+  register_t                         _predecoded_count = 0;
+  // the dispatch table the labels point into and the handler of words on
+  // pages that are not executable, set by bind_predecoded
+  void *const *_predecoded_table = nullptr;
+  void        *_predecoded_miss  = nullptr;
+#endif
+
+#ifdef DAWN_TAIL_CALL
+  // tail call engine state that does not fit in the handler arguments
+  uint64_t              _tail_budget = 0;
+  run_result_t          _tail_result = {};
+  exception_code_t      _tail_trap_cause;
+  register_t            _tail_trap_value;
+  decoded_instruction_t _tail_decoded = {};
+#endif
+
+#ifdef DAWN_JIT
+  static const size_t _code_cache_size = 1 << 24;
+  code_cache_t        _code_cache{_code_cache_size};
+  // blocks start out interpreted and are compiled once they ran this many
+  // times, lower values trade startup time for steady state throughput
+  // Note: can be changed between steps, blocks already counted past the new
+  // value are compiled the next time they run
+  uint32_t _jit_threshold = 64;
+#endif
+
+#ifdef DAWN_AOT
+  aot_library_t _aot;
+#endif
+
+#ifdef DAWN_SANDBOX
+  // set when a sandbox fault left the engine, execute runs it again
+  bool _sandbox_resume = false;
 #endif
 
   const std::vector<mmio_handler_t> _mmios;
   std::list<mmio_page_data_t>       _mmio_page_data;
 
-  std::atomic<bool> _wfi = false;
+  // Note: only the wfi instruction sets _wfi, hosts stop a run through
+  // request_exit or preempt
+  std::atomic<bool>    _wfi       = false;
+  std::atomic<uint8_t> _attention = 0;
+  preemption_timer_t   _preemption_timer;
   typedef void (*wfi_callback_t)();
   wfi_callback_t _wfi_callback = 0;
 
-  register_t _reg[32] = {0};
+  // Note: x0 is never written, _reg[sink_register] absorbs writes to it
+  register_t _reg[33] = {0};
   register_t _pc{0};
-  register_t _mode{0b11};
+  register_t _mode{_is_application ? 0b00u : 0b11u};
   register_t _reservation_address;
   bool       _is_reserved = false;
 
+  std::unordered_set<register_t> _watchpoints;
+
+  // instructions left for the guest across runs, a host enforces a per frame
+  // budget by setting it before running and reading it back afterwards
+  uint64_t _fuel = std::numeric_limits<uint64_t>::max();
+
 #ifdef DAWN_ENABLE_LOGGING
   std::ofstream _log{"/tmp/dawn", std::ios::trunc};
 #endif
@@ -0,0 +1,136 @@
+#ifndef DAWN_TESTS_GUEST_HPP
+#define DAWN_TESTS_GUEST_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+#define DAWN_RISCV64
+#include "dawn/dawn.hpp"
+
+// hand assembled rv64 programs for the tests, the engine under test is picked
+// by the DAWN_* definitions the test is built with
+namespace guest {
+
+enum reg_t : uint32_t {
+  zero = 0,
+  ra   = 1,
+  t0   = 5,
+  t1   = 6,
+  t2   = 7,
+  a0   = 10,
+  a1   = 11,
+  a7   = 17,
+  t3   = 28,
+};
+
+constexpr uint32_t i_type(uint32_t opcode, uint32_t funct3, reg_t rd,
+                          reg_t rs1, int32_t imm) {
+  return (static_cast<uint32_t>(imm) & 0xfff) << 20 | rs1 << 15 |
+         funct3 << 12 | rd << 7 | opcode;
+}
+constexpr uint32_t addi(reg_t rd, reg_t rs1, int32_t imm) {
+  return i_type(0x13, 0, rd, rs1, imm);
+}
+constexpr uint32_t jalr(reg_t rd, reg_t rs1, int32_t imm) {
+  return i_type(0x67, 0, rd, rs1, imm);
+}
+constexpr uint32_t lui(reg_t rd, uint32_t value) {
+  return (value & 0xfffff000) | rd << 7 | 0x37;
+}
+constexpr uint32_t auipc(reg_t rd, uint32_t value) {
+  return (value & 0xfffff000) | rd << 7 | 0x17;
+}
+constexpr uint32_t sw(reg_t rs2, reg_t rs1, int32_t imm) {
+  uint32_t bits = static_cast<uint32_t>(imm) & 0xfff;
+  return (bits >> 5) << 25 | rs2 << 20 | rs1 << 15 | 2 << 12 |
+         (bits & 0x1f) << 7 | 0x23;
+}
+constexpr uint32_t bne(reg_t rs1, reg_t rs2, int32_t offset) {
+  uint32_t bits = static_cast<uint32_t>(offset) & 0x1fff;
+  return (bits >> 12) << 31 | ((bits >> 5) & 0x3f) << 25 | rs2 << 20 |
+         rs1 << 15 | 1 << 12 | ((bits >> 1) & 0xf) << 8 |
+         ((bits >> 11) & 1) << 7 | 0x63;
+}
+constexpr uint32_t jal(reg_t rd, int32_t offset) {
+  uint32_t bits = static_cast<uint32_t>(offset) & 0x1fffff;
+  return (bits >> 20) << 31 | ((bits >> 1) & 0x3ff) << 21 |
+         ((bits >> 11) & 1) << 20 | ((bits >> 12) & 0xff) << 12 | rd << 7 |
+         0x6f;
+}
+constexpr uint32_t ecall() { return 0x00000073; }
+
+// lui and addi that load value into rd, addi sign extends its immediate
+inline void li(std::vector<uint32_t> &code, reg_t rd, uint32_t value) {
+  code.push_back(lui(rd, value + 0x800));
+  code.push_back(addi(rd, rd, static_cast<int32_t>(value << 20) >> 20));
+}
+
+using machine_t = dawn::machine_t<32, 12>;
+
+// where the program is loaded, with DAWN_FLAT_RAM inside the ram window
+constexpr uint64_t base     = 0x10000;
+constexpr uint64_t ram_size = 0x100000;
+
+inline uint8_t *allocate(void *, uint64_t size) { return new uint8_t[size](); }
+inline void     deallocate(void *, uint8_t *ptr) { delete[] ptr; }
+
+// the program starts at base in user mode, an ecall makes run return with
+// e_exit after it, any other trap fails the test
+inline std::unique_ptr<machine_t> load(const std::vector<uint32_t> &code) {
+  auto machine = std::make_unique<machine_t>(16 * 1024 * 1024,
+                                             std::vector<dawn::mmio_handler_t>{},
+                                             nullptr, allocate, deallocate,
+                                             dawn::page_metadata_t::e_rw);
+#ifdef DAWN_FLAT_RAM
+  if (!machine->map_ram(base, ram_size)) {
+    std::fprintf(stderr, "failed to map the ram window\n");
+    std::exit(1);
+  }
+#endif
+  if (!machine->insert_memory(base, code.data(), code.size() * 4,
+                              dawn::page_metadata_t::e_rwx)) {
+    std::fprintf(stderr, "failed to load the program\n");
+    std::exit(1);
+  }
+  machine->_pc             = base;
+  machine->_mode           = 0b00;
+  machine->_trap_usr_data  = machine.get();
+  machine->_trap_callback  = [](void *usr_data, dawn::exception_code_t cause,
+                               dawn::register_t value) {
+    machine_t *machine = static_cast<machine_t *>(usr_data);
+    if (cause != dawn::exception_code_t::e_ecall_u_mode) {
+      std::fprintf(stderr, "unexpected trap %llu at %llx, value %llx\n",
+                   static_cast<unsigned long long>(cause),
+                   static_cast<unsigned long long>(machine->_pc),
+                   static_cast<unsigned long long>(value));
+      std::exit(1);
+    }
+    machine->_pc += 4;
+    machine->request_exit();
+  };
+  return machine;
+}
+
+// fails the test unless value is expected
+template <typename type>
+inline void expect(const char *what, type value, type expected) {
+  if (value == expected) return;
+  std::fprintf(stderr, "%s: got %llu, expected %llu\n", what,
+               static_cast<unsigned long long>(value),
+               static_cast<unsigned long long>(expected));
+  std::exit(1);
+}
+
+// fails the test unless condition holds
+inline void check(const char *what, bool condition) {
+  if (condition) return;
+  std::fprintf(stderr, "%s: check failed\n", what);
+  std::exit(1);
+}
+
+}  // namespace guest
+
+#endif
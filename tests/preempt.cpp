@@ -0,0 +1,75 @@
+#include <chrono>
+#include <limits>
+#include <thread>
+
+#include "guest.hpp"
+
+// preempt and run_for on a loop that never ends, a preempt has to stop the
+// run and must not leak into the next one
+using namespace guest;
+using namespace std::chrono_literals;
+
+std::vector<uint32_t> program() {
+  std::vector<uint32_t> code;
+  code.push_back(addi(a0, a0, 1));
+  code.push_back(jal(zero, -4));
+  return code;
+}
+
+int main() {
+  using dawn::run_exit_t;
+  constexpr uint64_t unlimited = std::numeric_limits<uint64_t>::max();
+
+  auto               machine = load(program());
+  uint64_t           retired = 0;
+  dawn::run_result_t result;
+
+  // a preempt before the run stops it, once
+  machine->preempt();
+  result = machine->run(unlimited);
+  expect("preempt", result.reason, run_exit_t::e_preempted);
+  retired += result.retired;
+  result = machine->run(1000);
+  expect("after preempt", result.reason, run_exit_t::e_budget);
+  expect("after preempt retired", result.retired, uint64_t{1000});
+  retired += result.retired;
+
+  // from another thread while the guest runs
+  std::thread preempter([&] {
+    std::this_thread::sleep_for(10ms);
+    machine->preempt();
+  });
+  result = machine->run(unlimited);
+  preempter.join();
+  expect("thread", result.reason, run_exit_t::e_preempted);
+  check("thread retired", result.retired > 0);
+  retired += result.retired;
+
+  // the time slice runs out
+  auto start = std::chrono::steady_clock::now();
+  result     = machine->run_for(10ms);
+  auto spent = std::chrono::steady_clock::now() - start;
+  expect("run_for", result.reason, run_exit_t::e_preempted);
+  check("run_for time slice", spent >= 10ms && spent < 10s);
+  retired += result.retired;
+
+  // the budget runs out first, the timer is disarmed and does not preempt the
+  // runs after it
+  result = machine->run_for(10ms, 1000);
+  expect("run_for budget", result.reason, run_exit_t::e_budget);
+  expect("run_for budget retired", result.retired, uint64_t{1000});
+  retired += result.retired;
+  std::this_thread::sleep_for(20ms);
+  result = machine->run(1000);
+  expect("after run_for", result.reason, run_exit_t::e_budget);
+  expect("after run_for retired", result.retired, uint64_t{1000});
+  retired += result.retired;
+
+  // the retired counts of the preempted runs add up to what the guest ran,
+  // a0 counts the loop iterations started
+  bool at_jal = machine->_pc == base + 4;
+  expect("pc", machine->_pc, dawn::register_t{base + (retired % 2) * 4});
+  expect("a0", machine->_reg[a0],
+         dawn::register_t{(retired + at_jal) / 2});
+  return 0;
+}
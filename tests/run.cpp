@@ -0,0 +1,123 @@
+#include <string>
+
+#include "guest.hpp"
+
+// the results of run, the instruction budget, fuel and watchpoints on a loop
+// of known length, every engine has to stop at the same instructions
+using namespace guest;
+
+constexpr uint32_t iterations = 50;
+// two instructions before the loop, three in it and the ecall
+constexpr uint64_t total      = 2 + 3 * iterations + 1;
+constexpr uint64_t loop       = base + 2 * 4;
+
+std::vector<uint32_t> program() {
+  std::vector<uint32_t> code;
+  code.push_back(addi(a0, zero, 0));
+  code.push_back(addi(t1, zero, iterations));
+  code.push_back(addi(a0, a0, 3));  // loop
+  code.push_back(addi(t1, t1, -1));
+  code.push_back(bne(t1, zero, -2 * 4));
+  code.push_back(ecall());
+  return code;
+}
+
+// pc of the instruction after the first n ones
+uint64_t pc_after(uint64_t n) {
+  if (n < 2) return base + n * 4;
+  if (n >= total - 1) return base + (2 + 3 + n - (total - 1)) * 4;
+  return loop + (n - 2) % 3 * 4;
+}
+
+void expect_result(const char *what, dawn::run_result_t result,
+                   dawn::run_exit_t reason, uint64_t retired) {
+  std::string name = what;
+  expect((name + " reason").c_str(), result.reason, reason);
+  expect((name + " retired").c_str(), result.retired, retired);
+}
+
+int main() {
+  using dawn::run_exit_t;
+
+  // whole program
+  {
+    auto machine = load(program());
+    expect_result("run", machine->run(1'000'000), run_exit_t::e_exit, total);
+    expect("a0", machine->_reg[a0], dawn::register_t{3 * iterations});
+    expect("pc", machine->_pc, dawn::register_t{pc_after(total)});
+  }
+
+  // the budget stops a run in the middle of a block, the next one continues
+  // at the following instruction
+  {
+    auto machine = load(program());
+    expect_result("budget", machine->run(10), run_exit_t::e_budget, 10);
+    expect("budget pc", machine->_pc, dawn::register_t{pc_after(10)});
+    expect_result("budget rest", machine->run(1'000'000), run_exit_t::e_exit,
+                  total - 10);
+    expect("budget a0", machine->_reg[a0], dawn::register_t{3 * iterations});
+  }
+
+  // single stepping
+  {
+    auto     machine = load(program());
+    uint64_t steps   = 0;
+    for (;;) {
+      dawn::run_result_t result = machine->run(1);
+      expect("step retired", result.retired, uint64_t{1});
+      steps++;
+      if (result.reason == run_exit_t::e_exit) break;
+      expect("step reason", result.reason, run_exit_t::e_budget);
+      expect("step pc", machine->_pc, dawn::register_t{pc_after(steps)});
+    }
+    expect("steps", steps, total);
+    expect("step a0", machine->_reg[a0], dawn::register_t{3 * iterations});
+  }
+
+  // fuel runs out before the budget, then the budget runs out before the fuel
+  {
+    auto machine   = load(program());
+    machine->_fuel = 100;
+    expect_result("fuel", machine->run(1'000'000), run_exit_t::e_out_of_fuel,
+                  100);
+    expect("fuel left", machine->_fuel, uint64_t{0});
+    expect("fuel pc", machine->_pc, dawn::register_t{pc_after(100)});
+    expect_result("no fuel", machine->run(1'000'000),
+                  run_exit_t::e_out_of_fuel, 0);
+    machine->_fuel = 1000;
+    expect_result("fuel budget", machine->run(20), run_exit_t::e_budget, 20);
+    expect("fuel budget left", machine->_fuel, uint64_t{980});
+    expect_result("fuel rest", machine->run(1'000'000), run_exit_t::e_exit,
+                  total - 120);
+    expect("fuel rest left", machine->_fuel, uint64_t{980 - (total - 120)});
+  }
+
+  // a watchpoint at the head of the loop stops every iteration before it, the
+  // run that starts at it continues past it
+  {
+    auto machine = load(program());
+    machine->add_watchpoint(loop);
+    uint64_t retired = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+      dawn::run_result_t result = machine->run(1'000'000);
+      expect("watchpoint reason", result.reason, run_exit_t::e_watchpoint);
+      expect("watchpoint retired", result.retired,
+             i == 0 ? uint64_t{2} : uint64_t{3});
+      expect("watchpoint pc", machine->_pc, dawn::register_t{loop});
+      expect("watchpoint a0", machine->_reg[a0], dawn::register_t{3 * i});
+      retired += result.retired;
+    }
+    expect_result("watchpoint end", machine->run(1'000'000),
+                  run_exit_t::e_exit, total - retired);
+
+    // removed, the loop runs through
+    machine         = load(program());
+    machine->add_watchpoint(loop);
+    expect_result("watchpoint first", machine->run(1'000'000),
+                  run_exit_t::e_watchpoint, 2);
+    machine->remove_watchpoint(loop);
+    expect_result("watchpoint removed", machine->run(1'000'000),
+                  run_exit_t::e_exit, total - 2);
+  }
+  return 0;
+}
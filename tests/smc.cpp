@@ -0,0 +1,36 @@
+#include "guest.hpp"
+
+// a function runs until it is hot, the program then rewrites its first
+// instruction without a fence.i and calls it again, every engine has to see
+// the new instruction
+int main() {
+  using namespace guest;
+
+  constexpr uint32_t calls    = 100;  // more than _jit_threshold
+  constexpr int32_t  function = 14 * 4;
+  constexpr int32_t  patched  = 7 * 4;  // the auipc below
+
+  std::vector<uint32_t> code;
+  code.push_back(addi(a0, zero, 1));
+  code.push_back(addi(t1, zero, calls));
+  code.push_back(jal(ra, function - 2 * 4));  // a0 += 1
+  code.push_back(addi(t1, t1, -1));
+  code.push_back(bne(t1, zero, -2 * 4));
+  li(code, t2, addi(a0, a0, 4));
+  code.push_back(auipc(t3, 0));
+  code.push_back(sw(t2, t3, function - patched));
+  code.push_back(addi(t1, zero, calls));
+  code.push_back(jal(ra, function - 10 * 4));  // a0 += 4 once patched
+  code.push_back(addi(t1, t1, -1));
+  code.push_back(bne(t1, zero, -2 * 4));
+  code.push_back(ecall());
+  // function
+  code.push_back(addi(a0, a0, 1));
+  code.push_back(jalr(zero, ra, 0));
+
+  auto machine = load(code);
+  dawn::run_result_t result = machine->run(1'000'000);
+  expect("reason", result.reason, dawn::run_exit_t::e_exit);
+  expect("a0", machine->_reg[a0], dawn::register_t{1 + calls + 4 * calls});
+  return 0;
+}